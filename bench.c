@@ -0,0 +1,1152 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* Copyright © 2019-2023 Hans Petter Jansson. See COPYING for details. */
+
+/* Standalone benchmark. Unlike test.c, this depends on nothing but libc, so it
+ * can be built and run anywhere Smolscale itself can. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> /* sysconf */
+#include <pthread.h>
+#include "smolscale.h"
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+#endif
+
+#define DEFAULT_SIZE 512
+#define DEFAULT_N_ITERATIONS 15
+#define DEFAULT_N_WARMUP 3
+#define DEFAULT_TOLERANCE_PCT 10.0
+
+/* Exit status when a result falls short of its baseline */
+#define EXIT_REGRESSION 2
+
+/* Batch sizes for the thread sweep (-T). 0 means height_out / n_threads,
+ * which is how test.c splits the work. */
+static const uint32_t sweep_batch_sizes [] = { 0, 1, 8, 32, 128 };
+
+#define N_SWEEP_BATCH_SIZES (sizeof (sweep_batch_sizes) / sizeof (sweep_batch_sizes [0]))
+
+/* Output size for each case is size * num / den. The ratios are chosen so
+ * that pick_filter_params() lands on the named filter. */
+
+typedef struct
+{
+    const char *name;
+    uint32_t num, den;
+}
+BenchCase;
+
+static const BenchCase bench_cases [] =
+{
+    { "copy",         1,   1 },
+    { "one",          1,   1 },
+    { "bilinear-up",  3,   2 },
+    { "bilinear-0h",  3,   4 },
+    { "bilinear-1h",  3,   8 },
+    { "bilinear-2h",  3,  16 },
+    { "box",          1,  16 },
+    { "box-128",      1, 300 },
+
+    { NULL,           0,   0 }
+};
+
+static const char * const pixel_type_names [SMOL_PIXEL_MAX] =
+{
+    /* Premultiplied */
+    "RGBA8",
+    "BGRA8",
+    "ARGB8",
+    "ABGR8",
+
+    /* Unassociated */
+    "rgbA8",
+    "bgrA8",
+    "Argb8",
+    "Abgr8",
+
+    /* No alpha */
+    "rgb8",
+    "bgr8"
+};
+
+/* Fixed matrix for regression runs (-R). Changing it invalidates stored
+ * baselines; new entries will be reported as missing from them. */
+
+static const uint32_t regress_sizes [] = { 256, 1024, 0 };
+
+static const SmolPixelType regress_pixel_types [] [2] =
+{
+    { SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_RGBA8_PREMULTIPLIED },
+    { SMOL_PIXEL_RGBA8_UNASSOCIATED,  SMOL_PIXEL_RGBA8_UNASSOCIATED },
+    { SMOL_PIXEL_RGB8,                SMOL_PIXEL_BGRA8_PREMULTIPLIED },
+
+    { SMOL_PIXEL_MAX,                 SMOL_PIXEL_MAX }
+};
+
+typedef struct
+{
+    uint32_t width, height;
+    uint32_t n_iterations;
+    uint32_t n_warmup;
+    const char *case_name;
+    int pixel_type_in;
+    int pixel_type_out;
+    int with_srgb;
+    int regress;
+    const char *csv_fname;
+    const char *baseline_fname;
+    double tolerance_pct;
+    uint32_t max_threads;
+    int use_counters;
+}
+BenchParams;
+
+typedef struct
+{
+    const BenchCase *bench_case;
+    uint32_t width, height;
+    SmolPixelType pixel_type_in;
+    SmolPixelType pixel_type_out;
+    int with_srgb;
+}
+BenchConfig;
+
+/* Hardware counters (-P). Only available on Linux, and only if
+ * perf_event_paranoid allows it. Only the calling thread is counted. */
+
+typedef enum
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+
+    N_COUNTERS
+}
+CounterType;
+
+/* Each LLC miss is assumed to fetch one line from memory */
+#define CACHE_LINE_SIZE 64
+
+typedef struct
+{
+    int enabled;
+    int fds [N_COUNTERS];
+}
+PerfCounters;
+
+static PerfCounters perf_counters;
+
+typedef struct
+{
+    uint32_t width_in, height_in;
+    uint32_t width_out, height_out;
+    SmolScaleInfo info;
+
+    /* Sorted, in nanoseconds */
+    double *samples;
+    uint32_t n_samples;
+
+    /* Summed over all timed iterations, if counters are enabled */
+    uint64_t counters [N_COUNTERS];
+}
+BenchResult;
+
+typedef struct
+{
+    char *key;
+    double mpix_per_s;
+}
+BaselineEntry;
+
+typedef struct
+{
+    BaselineEntry *entries;
+    uint32_t n_entries;
+}
+Baseline;
+
+static double
+get_time_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#ifdef __linux__
+
+static int
+open_counter (uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset (&attr, 0, sizeof (attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof (attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int
+init_counters (void)
+{
+    static const uint64_t configs [N_COUNTERS] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    int i;
+
+    for (i = 0; i < N_COUNTERS; i++)
+    {
+        perf_counters.fds [i] = open_counter (configs [i]);
+        if (perf_counters.fds [i] < 0)
+        {
+            while (i--)
+                close (perf_counters.fds [i]);
+            return 0;
+        }
+    }
+
+    perf_counters.enabled = 1;
+    return 1;
+}
+
+static void
+start_counters (void)
+{
+    int i;
+
+    for (i = 0; i < N_COUNTERS; i++)
+    {
+        ioctl (perf_counters.fds [i], PERF_EVENT_IOC_RESET, 0);
+        ioctl (perf_counters.fds [i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void
+stop_counters (uint64_t *counters_inout)
+{
+    uint64_t value;
+    int i;
+
+    for (i = 0; i < N_COUNTERS; i++)
+    {
+        ioctl (perf_counters.fds [i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read (perf_counters.fds [i], &value, sizeof (value)) == sizeof (value))
+            counters_inout [i] += value;
+    }
+}
+
+#else
+
+static int
+init_counters (void)
+{
+    return 0;
+}
+
+static void
+start_counters (void)
+{
+}
+
+static void
+stop_counters (uint64_t *counters_inout)
+{
+    (void) counters_inout;
+}
+
+#endif
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static double
+get_percentile (const BenchResult *result, double p)
+{
+    return result->samples [(uint32_t) ((result->n_samples - 1) * p + 0.5)];
+}
+
+static unsigned char *
+gen_canvas (size_t n_bytes)
+{
+    unsigned char *canvas;
+    uint32_t seed = 0x12345678;
+    size_t i;
+
+    canvas = malloc (n_bytes);
+
+    for (i = 0; i < n_bytes; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        canvas [i] = seed >> 24;
+    }
+
+    return canvas;
+}
+
+static uint32_t
+get_bytes_per_pixel (SmolPixelType pixel_type)
+{
+    return pixel_type >= SMOL_PIXEL_RGB8 ? 3 : 4;
+}
+
+static void
+get_case_dims (const BenchCase *bench_case, uint32_t width, uint32_t height,
+               uint32_t *width_in, uint32_t *height_in,
+               uint32_t *width_out, uint32_t *height_out)
+{
+    if (!strcmp (bench_case->name, "one"))
+    {
+        *width_in = *height_in = 1;
+        *width_out = width;
+        *height_out = height;
+        return;
+    }
+
+    *width_in = width;
+    *height_in = height;
+    *width_out = width * bench_case->num / bench_case->den;
+    *height_out = height * bench_case->num / bench_case->den;
+
+    if (*width_out < 1)
+        *width_out = 1;
+    if (*height_out < 1)
+        *height_out = 1;
+}
+
+/* Workers pull batches of rows from a shared counter until the image is
+ * done. The calling thread takes part too. */
+typedef struct
+{
+    const SmolScaleCtx *scale_ctx;
+    uint32_t height_out;
+    uint32_t batch_n_rows;
+    uint32_t next_row;
+    int quit;
+
+    pthread_t *threads;
+    uint32_t n_threads;
+    pthread_barrier_t start_barrier;
+    pthread_barrier_t end_barrier;
+}
+WorkerPool;
+
+static void
+scale_batches (WorkerPool *pool)
+{
+    for (;;)
+    {
+        uint32_t first_row = __atomic_fetch_add (&pool->next_row, pool->batch_n_rows,
+                                                 __ATOMIC_RELAXED);
+        uint32_t n_rows;
+
+        if (first_row >= pool->height_out)
+            break;
+
+        n_rows = pool->height_out - first_row;
+        if (n_rows > pool->batch_n_rows)
+            n_rows = pool->batch_n_rows;
+
+        smol_scale_batch (pool->scale_ctx, first_row, n_rows);
+    }
+}
+
+static void *
+worker_main (void *data)
+{
+    WorkerPool *pool = data;
+
+    for (;;)
+    {
+        pthread_barrier_wait (&pool->start_barrier);
+        if (pool->quit)
+            break;
+
+        scale_batches (pool);
+        pthread_barrier_wait (&pool->end_barrier);
+    }
+
+    return NULL;
+}
+
+static void
+init_pool (WorkerPool *pool,
+           const SmolScaleCtx *scale_ctx,
+           uint32_t height_out,
+           uint32_t n_threads,
+           uint32_t batch_n_rows)
+{
+    uint32_t i;
+
+    pool->scale_ctx = scale_ctx;
+    pool->height_out = height_out;
+    pool->batch_n_rows = batch_n_rows;
+    pool->quit = 0;
+    pool->n_threads = n_threads;
+    pool->threads = malloc (n_threads * sizeof (pthread_t));
+
+    pthread_barrier_init (&pool->start_barrier, NULL, n_threads);
+    pthread_barrier_init (&pool->end_barrier, NULL, n_threads);
+
+    for (i = 1; i < n_threads; i++)
+        pthread_create (&pool->threads [i], NULL, worker_main, pool);
+}
+
+static void
+run_pool (WorkerPool *pool)
+{
+    pool->next_row = 0;
+
+    if (pool->n_threads < 2)
+    {
+        scale_batches (pool);
+        return;
+    }
+
+    pthread_barrier_wait (&pool->start_barrier);
+    scale_batches (pool);
+    pthread_barrier_wait (&pool->end_barrier);
+}
+
+static void
+finalize_pool (WorkerPool *pool)
+{
+    uint32_t i;
+
+    if (pool->n_threads > 1)
+    {
+        pool->quit = 1;
+        pthread_barrier_wait (&pool->start_barrier);
+
+        for (i = 1; i < pool->n_threads; i++)
+            pthread_join (pool->threads [i], NULL);
+    }
+
+    pthread_barrier_destroy (&pool->start_barrier);
+    pthread_barrier_destroy (&pool->end_barrier);
+    free (pool->threads);
+}
+
+/* Scales the image in batches of batch_n_rows spread over n_threads. If
+ * batch_n_rows is 0, the whole image is split evenly between threads. */
+static void
+run_config (const BenchParams *params,
+            const BenchConfig *config,
+            uint32_t n_threads,
+            uint32_t batch_n_rows,
+            BenchResult *result)
+{
+    WorkerPool pool;
+    SmolPixelType pixel_type_in = config->pixel_type_in;
+    SmolPixelType pixel_type_out = config->pixel_type_out;
+    unsigned char *pixels_in, *pixels_out;
+    uint32_t rowstride_in, rowstride_out;
+    SmolScaleCtx *scale_ctx;
+    uint32_t i;
+
+    get_case_dims (config->bench_case, config->width, config->height,
+                   &result->width_in, &result->height_in,
+                   &result->width_out, &result->height_out);
+
+    rowstride_in = result->width_in * get_bytes_per_pixel (pixel_type_in);
+    rowstride_out = result->width_out * get_bytes_per_pixel (pixel_type_out);
+
+    pixels_in = gen_canvas ((size_t) rowstride_in * result->height_in);
+    pixels_out = malloc ((size_t) rowstride_out * result->height_out);
+
+    scale_ctx = smol_scale_new (pixels_in, pixel_type_in,
+                                result->width_in, result->height_in, rowstride_in,
+                                pixels_out, pixel_type_out,
+                                result->width_out, result->height_out, rowstride_out,
+                                config->with_srgb);
+    smol_scale_get_info (scale_ctx, &result->info);
+
+    if (batch_n_rows == 0)
+        batch_n_rows = (result->height_out + n_threads - 1) / n_threads;
+
+    init_pool (&pool, scale_ctx, result->height_out, n_threads, batch_n_rows);
+
+    for (i = 0; i < params->n_warmup; i++)
+        run_pool (&pool);
+
+    result->n_samples = params->n_iterations;
+    result->samples = malloc (result->n_samples * sizeof (double));
+    memset (result->counters, 0, sizeof (result->counters));
+
+    for (i = 0; i < params->n_iterations; i++)
+    {
+        double t0;
+
+        if (perf_counters.enabled)
+            start_counters ();
+
+        t0 = get_time_ns ();
+        run_pool (&pool);
+        result->samples [i] = get_time_ns () - t0;
+
+        if (perf_counters.enabled)
+            stop_counters (result->counters);
+    }
+
+    qsort (result->samples, result->n_samples, sizeof (double), compare_doubles);
+
+    finalize_pool (&pool);
+    smol_scale_destroy (scale_ctx);
+    free (pixels_out);
+    free (pixels_in);
+}
+
+static void
+print_header (void)
+{
+    printf ("%-12s %-5s %-5s %4s %4s %-7s %11s %11s %9s %9s %9s %9s",
+            "filter", "in", "out", "srgb", "bpp", "impl", "in", "out",
+            "Mpix/s", "ns/row", "ns/row", "ns/row");
+    if (perf_counters.enabled)
+        printf (" %6s %9s %7s", "IPC", "LLCmiss", "est.B");
+    printf ("\n%-12s %-5s %-5s %4s %4s %-7s %11s %11s %9s %9s %9s %9s",
+            "", "", "", "", "", "", "", "",
+            "p50", "p10", "p50", "p90");
+    if (perf_counters.enabled)
+        printf (" %6s %9s %7s", "", "/kpix", "/pix");
+    printf ("\n");
+}
+
+/* Count both input and output pixels, like test.c does */
+static double
+get_n_pixels (const BenchResult *result)
+{
+    return result->width_in * (double) result->height_in
+        + result->width_out * (double) result->height_out;
+}
+
+static double
+get_mpix_per_s (const BenchResult *result)
+{
+    return get_n_pixels (result) * 1e3 / get_percentile (result, 0.5);
+}
+
+static double
+get_ipc (const BenchResult *result)
+{
+    if (!result->counters [COUNTER_CYCLES])
+        return 0.0;
+
+    return result->counters [COUNTER_INSTRUCTIONS] / (double) result->counters [COUNTER_CYCLES];
+}
+
+/* Per pixel, per iteration */
+static double
+get_llc_misses_per_pixel (const BenchResult *result)
+{
+    return result->counters [COUNTER_LLC_MISSES] / (get_n_pixels (result) * result->n_samples);
+}
+
+static void
+print_result (const BenchConfig *config,
+              const BenchResult *result)
+{
+    char dims_in [24], dims_out [24];
+
+    snprintf (dims_in, sizeof (dims_in), "%ux%u", result->width_in, result->height_in);
+    snprintf (dims_out, sizeof (dims_out), "%ux%u", result->width_out, result->height_out);
+
+    printf ("%-12s %-5s %-5s %4d %4u %-7s %11s %11s %9.1f %9.1f %9.1f %9.1f",
+            config->bench_case->name,
+            pixel_type_names [config->pixel_type_in],
+            pixel_type_names [config->pixel_type_out],
+            config->with_srgb,
+            result->info.storage_bpp,
+            result->info.implementation_v,
+            dims_in, dims_out,
+            get_mpix_per_s (result),
+            get_percentile (result, 0.1) / result->height_out,
+            get_percentile (result, 0.5) / result->height_out,
+            get_percentile (result, 0.9) / result->height_out);
+    if (perf_counters.enabled)
+        printf (" %6.2f %9.2f %7.2f",
+                get_ipc (result),
+                get_llc_misses_per_pixel (result) * 1000.0,
+                get_llc_misses_per_pixel (result) * CACHE_LINE_SIZE);
+    printf ("\n");
+    fflush (stdout);
+}
+
+/* Compares each thread count and batch size against a single thread doing
+ * the whole image in one batch. Batch overhead is the single-thread cost of
+ * splitting the image into batches of that size, which comes mostly from
+ * re-priming the vertical filter's row cache at each batch boundary. */
+static void
+run_thread_sweep (const BenchParams *params,
+                  const BenchConfig *config)
+{
+    double single_ns [N_SWEEP_BATCH_SIZES];
+    BenchResult result;
+    double base_ns = 0.0;
+    uint32_t n_threads;
+    uint32_t i;
+
+    get_case_dims (config->bench_case, config->width, config->height,
+                   &result.width_in, &result.height_in,
+                   &result.width_out, &result.height_out);
+
+    printf ("\n%s %s -> %s srgb=%d, %ux%u -> %ux%u\n",
+            config->bench_case->name,
+            pixel_type_names [config->pixel_type_in],
+            pixel_type_names [config->pixel_type_out],
+            config->with_srgb,
+            result.width_in, result.height_in,
+            result.width_out, result.height_out);
+    printf ("%7s %7s %9s %8s %7s %9s\n",
+            "threads", "batch", "Mpix/s", "speedup", "eff%", "overhead%");
+
+    for (n_threads = 1; ; n_threads = n_threads * 2 > params->max_threads
+             ? params->max_threads : n_threads * 2)
+    {
+        for (i = 0; i < N_SWEEP_BATCH_SIZES; i++)
+        {
+            uint32_t batch_n_rows = sweep_batch_sizes [i];
+            double ns, speedup;
+
+            if (batch_n_rows == 0)
+                batch_n_rows = (result.height_out + n_threads - 1) / n_threads;
+            else if (batch_n_rows >= result.height_out)
+                continue;
+
+            run_config (params, config, n_threads, batch_n_rows, &result);
+            ns = get_percentile (&result, 0.5);
+
+            /* Single-threaded runs come first, starting with the whole
+             * image in one batch */
+            if (n_threads == 1)
+            {
+                if (i == 0)
+                    base_ns = ns;
+                single_ns [i] = ns;
+            }
+
+            speedup = base_ns / ns;
+
+            printf ("%7u %7u %9.1f %8.2f %7.1f ",
+                    n_threads, batch_n_rows,
+                    get_mpix_per_s (&result),
+                    speedup,
+                    speedup * 100.0 / n_threads);
+
+            /* The even split differs per thread count, so its single-threaded
+             * overhead is only known for one thread */
+            if (i == 0 && n_threads > 1)
+                printf ("%9s\n", "-");
+            else
+                printf ("%9.1f\n", (single_ns [i] / base_ns - 1.0) * 100.0);
+
+            fflush (stdout);
+            free (result.samples);
+        }
+
+        if (n_threads >= params->max_threads)
+            break;
+    }
+}
+
+static int
+lookup_pixel_type (const char *name)
+{
+    int i;
+
+    for (i = 0; i < SMOL_PIXEL_MAX; i++)
+    {
+        if (!strcmp (name, pixel_type_names [i]))
+            return i;
+    }
+
+    fprintf (stderr, "Unknown pixel type: %s\n", name);
+    exit (1);
+}
+
+
+/* The key identifies a configuration across runs */
+static void
+format_key (const BenchConfig *config,
+            const BenchResult *result,
+            char *key,
+            size_t key_size)
+{
+    snprintf (key, key_size, "%s,%s,%s,%d,%u,%u,%u,%u",
+              config->bench_case->name,
+              pixel_type_names [config->pixel_type_in],
+              pixel_type_names [config->pixel_type_out],
+              config->with_srgb,
+              result->width_in, result->height_in,
+              result->width_out, result->height_out);
+}
+
+static void
+write_csv_header (FILE *f)
+{
+    fprintf (f, "filter,type_in,type_out,srgb,width_in,height_in,width_out,height_out,"
+             "storage_bpp,implementation,mpix_per_s,ns_per_row_p10,ns_per_row_p50,ns_per_row_p90");
+    if (perf_counters.enabled)
+        fprintf (f, ",ipc,llc_misses_per_pixel,est_bytes_per_pixel");
+    fprintf (f, "\n");
+}
+
+static void
+write_csv_row (FILE *f,
+               const BenchConfig *config,
+               const BenchResult *result)
+{
+    char key [256];
+
+    format_key (config, result, key, sizeof (key));
+
+    fprintf (f, "%s,%u,%s,%.3f,%.3f,%.3f,%.3f",
+             key,
+             result->info.storage_bpp,
+             result->info.implementation_v,
+             get_mpix_per_s (result),
+             get_percentile (result, 0.1) / result->height_out,
+             get_percentile (result, 0.5) / result->height_out,
+             get_percentile (result, 0.9) / result->height_out);
+    if (perf_counters.enabled)
+        fprintf (f, ",%.3f,%.5f,%.3f",
+                 get_ipc (result),
+                 get_llc_misses_per_pixel (result),
+                 get_llc_misses_per_pixel (result) * CACHE_LINE_SIZE);
+    fprintf (f, "\n");
+}
+
+/* Reads a CSV file previously written with -c */
+static void
+load_baseline (const char *fname, Baseline *baseline)
+{
+    char line [1024];
+    uint32_t n_alloc = 0;
+    FILE *f;
+
+    baseline->entries = NULL;
+    baseline->n_entries = 0;
+
+    f = fopen (fname, "r");
+    if (!f)
+    {
+        fprintf (stderr, "Could not open baseline file %s\n", fname);
+        exit (1);
+    }
+
+    while (fgets (line, sizeof (line), f))
+    {
+        BaselineEntry *entry;
+        char *p = line;
+        int i;
+
+        if (!strncmp (line, "filter,", 7))
+            continue;
+
+        /* Key is the first 8 fields; throughput is the 11th */
+
+        for (i = 0; i < 8 && p; i++)
+            p = strchr (p + 1, ',');
+        if (!p)
+            continue;
+
+        if (baseline->n_entries == n_alloc)
+        {
+            n_alloc = n_alloc ? n_alloc * 2 : 256;
+            baseline->entries = realloc (baseline->entries, n_alloc * sizeof (BaselineEntry));
+        }
+
+        entry = &baseline->entries [baseline->n_entries++];
+        entry->key = strndup (line, p - line);
+
+        for (i = 0; i < 2 && p; i++)
+            p = strchr (p + 1, ',');
+        entry->mpix_per_s = p ? strtod (p + 1, NULL) : 0.0;
+    }
+
+    fclose (f);
+}
+
+static void
+free_baseline (Baseline *baseline)
+{
+    uint32_t i;
+
+    for (i = 0; i < baseline->n_entries; i++)
+        free (baseline->entries [i].key);
+
+    free (baseline->entries);
+}
+
+/* Returns nonzero if the result is slower than its baseline by more than the
+ * tolerance. */
+static int
+check_baseline (const BenchParams *params,
+                const Baseline *baseline,
+                const BenchConfig *config,
+                const BenchResult *result)
+{
+    char key [256];
+    double mpix_per_s;
+    uint32_t i;
+
+    format_key (config, result, key, sizeof (key));
+
+    for (i = 0; i < baseline->n_entries; i++)
+    {
+        if (!strcmp (baseline->entries [i].key, key))
+            break;
+    }
+
+    if (i == baseline->n_entries)
+    {
+        printf ("  not in baseline: %s\n", key);
+        return 0;
+    }
+
+    mpix_per_s = get_mpix_per_s (result);
+
+    if (mpix_per_s < baseline->entries [i].mpix_per_s * (1.0 - params->tolerance_pct / 100.0))
+    {
+        printf ("  REGRESSION: %s: %.1f Mpix/s, baseline %.1f (%+.1f%%)\n",
+                key, mpix_per_s, baseline->entries [i].mpix_per_s,
+                (mpix_per_s / baseline->entries [i].mpix_per_s - 1.0) * 100.0);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void
+print_usage (void)
+{
+    int i;
+
+    fprintf (stderr,
+             "Usage: bench [options]\n\n"
+             "  -s SIZE        Input size, as N for NxN or as WxH [%u]\n"
+             "  -n N           Timed iterations per configuration [%u]\n"
+             "  -w N           Warmup iterations per configuration [%u]\n"
+             "  -f FILTER      Only run this filter case\n"
+             "  -i TYPE        Only use this input pixel type\n"
+             "  -o TYPE        Only use this output pixel type\n"
+             "  -g 0|1         Only run without/with sRGB linearization\n\n"
+             "  -R             Run the fixed regression matrix instead of -s/-i/-o\n"
+             "  -c FILE        Write results to FILE as CSV\n"
+             "  -b FILE        Compare against a CSV baseline written with -c. Exits\n"
+             "                 with status %d if any result is slower than allowed\n"
+             "  -t PCT         Allowed throughput drop relative to baseline [%.0f]\n\n"
+             "  -P             Read hardware counters (Linux only) and report IPC, LLC\n"
+             "                 misses and estimated memory traffic per pixel\n"
+             "  -T N           Sweep thread counts up to N (0 for all CPUs) and batch\n"
+             "                 sizes, reporting speedup and efficiency. Uses RGBA8\n"
+             "                 unless -i/-o are given. Can't be used with -c or -b\n\n"
+             "Filter cases:",
+             DEFAULT_SIZE, DEFAULT_N_ITERATIONS, DEFAULT_N_WARMUP,
+             EXIT_REGRESSION, DEFAULT_TOLERANCE_PCT);
+
+    for (i = 0; bench_cases [i].name; i++)
+        fprintf (stderr, " %s", bench_cases [i].name);
+
+    fprintf (stderr, "\nPixel types:");
+
+    for (i = 0; i < SMOL_PIXEL_MAX; i++)
+        fprintf (stderr, " %s", pixel_type_names [i]);
+
+    fprintf (stderr, "\n");
+}
+
+static void
+parse_args (int argc, char *argv [], BenchParams *params)
+{
+    int i;
+
+    params->width = params->height = DEFAULT_SIZE;
+    params->n_iterations = DEFAULT_N_ITERATIONS;
+    params->n_warmup = DEFAULT_N_WARMUP;
+    params->case_name = NULL;
+    params->pixel_type_in = -1;
+    params->pixel_type_out = -1;
+    params->with_srgb = -1;
+    params->regress = 0;
+    params->csv_fname = NULL;
+    params->baseline_fname = NULL;
+    params->tolerance_pct = DEFAULT_TOLERANCE_PCT;
+    params->max_threads = 0;
+    params->use_counters = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv [i];
+        const char *value;
+
+        if (!strcmp (arg, "-R"))
+        {
+            params->regress = 1;
+            continue;
+        }
+
+        if (!strcmp (arg, "-P"))
+        {
+            params->use_counters = 1;
+            continue;
+        }
+
+        if (arg [0] != '-' || !arg [1] || arg [2] || i + 1 >= argc)
+        {
+            print_usage ();
+            exit (1);
+        }
+
+        value = argv [++i];
+
+        switch (arg [1])
+        {
+            case 's':
+            {
+                char *end;
+
+                params->width = params->height = strtoul (value, &end, 10);
+                if (*end == 'x')
+                    params->height = strtoul (end + 1, NULL, 10);
+                break;
+            }
+            case 'n':
+                params->n_iterations = strtoul (value, NULL, 10);
+                break;
+            case 'w':
+                params->n_warmup = strtoul (value, NULL, 10);
+                break;
+            case 'f':
+                params->case_name = value;
+                break;
+            case 'i':
+                params->pixel_type_in = lookup_pixel_type (value);
+                break;
+            case 'o':
+                params->pixel_type_out = lookup_pixel_type (value);
+                break;
+            case 'g':
+                params->with_srgb = strtoul (value, NULL, 10) ? 1 : 0;
+                break;
+            case 'c':
+                params->csv_fname = value;
+                break;
+            case 'b':
+                params->baseline_fname = value;
+                break;
+            case 't':
+                params->tolerance_pct = strtod (value, NULL);
+                break;
+            case 'T':
+                params->max_threads = strtoul (value, NULL, 10);
+                if (params->max_threads == 0)
+                    params->max_threads = sysconf (_SC_NPROCESSORS_ONLN);
+                break;
+            default:
+                print_usage ();
+                exit (1);
+        }
+    }
+
+    if (params->width < 1 || params->width > 65535
+        || params->height < 1 || params->height > 65535
+        || params->n_iterations < 1)
+    {
+        print_usage ();
+        exit (1);
+    }
+
+    /* CSV rows and baselines have no thread count or batch size */
+    if (params->max_threads && (params->csv_fname || params->baseline_fname))
+    {
+        fprintf (stderr, "-T can't be combined with -c or -b.\n");
+        exit (1);
+    }
+
+    /* The full pixel type matrix would take forever to sweep */
+    if (params->max_threads)
+    {
+        if (params->pixel_type_in < 0)
+            params->pixel_type_in = SMOL_PIXEL_RGBA8_PREMULTIPLIED;
+        if (params->pixel_type_out < 0)
+            params->pixel_type_out = SMOL_PIXEL_RGBA8_PREMULTIPLIED;
+    }
+}
+
+/* Expands the options into a list of configurations to run */
+static BenchConfig *
+get_configs (const BenchParams *params, uint32_t *n_configs_out)
+{
+    const BenchCase *bench_case;
+    BenchConfig *configs;
+    uint32_t n_configs = 0;
+    int size_index, pair_index;
+    int with_srgb;
+
+    configs = malloc (sizeof (BenchConfig) * SMOL_PIXEL_MAX * SMOL_PIXEL_MAX * 2
+                      * (sizeof (bench_cases) / sizeof (bench_cases [0]))
+                      * (sizeof (regress_sizes) / sizeof (regress_sizes [0])));
+
+    for (bench_case = bench_cases; bench_case->name; bench_case++)
+    {
+        if (params->case_name && strcmp (params->case_name, bench_case->name))
+            continue;
+
+        for (with_srgb = 0; with_srgb < 2; with_srgb++)
+        {
+            if (params->with_srgb >= 0 && params->with_srgb != with_srgb)
+                continue;
+
+            if (params->regress)
+            {
+                for (size_index = 0; regress_sizes [size_index]; size_index++)
+                {
+                    for (pair_index = 0;
+                         regress_pixel_types [pair_index] [0] != SMOL_PIXEL_MAX;
+                         pair_index++)
+                    {
+                        BenchConfig *config = &configs [n_configs++];
+
+                        config->bench_case = bench_case;
+                        config->width = config->height = regress_sizes [size_index];
+                        config->pixel_type_in = regress_pixel_types [pair_index] [0];
+                        config->pixel_type_out = regress_pixel_types [pair_index] [1];
+                        config->with_srgb = with_srgb;
+                    }
+                }
+
+                continue;
+            }
+
+            for (pair_index = 0; pair_index < SMOL_PIXEL_MAX * SMOL_PIXEL_MAX; pair_index++)
+            {
+                BenchConfig *config;
+                int pixel_type_in = pair_index / SMOL_PIXEL_MAX;
+                int pixel_type_out = pair_index % SMOL_PIXEL_MAX;
+
+                if ((params->pixel_type_in >= 0 && params->pixel_type_in != pixel_type_in)
+                    || (params->pixel_type_out >= 0 && params->pixel_type_out != pixel_type_out))
+                    continue;
+
+                config = &configs [n_configs++];
+                config->bench_case = bench_case;
+                config->width = params->width;
+                config->height = params->height;
+                config->pixel_type_in = pixel_type_in;
+                config->pixel_type_out = pixel_type_out;
+                config->with_srgb = with_srgb;
+            }
+        }
+    }
+
+    *n_configs_out = n_configs;
+    return configs;
+}
+
+int
+main (int argc, char *argv [])
+{
+    BenchParams params;
+    BenchConfig *configs;
+    uint32_t n_configs;
+    Baseline baseline = { NULL, 0 };
+    FILE *csv_file = NULL;
+    int n_regressions = 0;
+    uint32_t i;
+
+    parse_args (argc, argv, &params);
+
+    if (params.use_counters && !init_counters ())
+        fprintf (stderr, "Hardware counters unavailable; check perf_event_paranoid.\n");
+
+    configs = get_configs (&params, &n_configs);
+    if (n_configs == 0)
+    {
+        fprintf (stderr, "No configurations matched.\n");
+        return 1;
+    }
+
+    if (params.baseline_fname)
+        load_baseline (params.baseline_fname, &baseline);
+
+    if (params.csv_fname)
+    {
+        csv_file = fopen (params.csv_fname, "w");
+        if (!csv_file)
+        {
+            fprintf (stderr, "Could not open %s for writing\n", params.csv_fname);
+            return 1;
+        }
+
+        write_csv_header (csv_file);
+    }
+
+    if (params.max_threads)
+    {
+        for (i = 0; i < n_configs; i++)
+            run_thread_sweep (&params, &configs [i]);
+    }
+    else
+    {
+        print_header ();
+
+        for (i = 0; i < n_configs; i++)
+        {
+            BenchResult result;
+
+            run_config (&params, &configs [i], 1, 0, &result);
+            print_result (&configs [i], &result);
+
+            if (csv_file)
+                write_csv_row (csv_file, &configs [i], &result);
+
+            if (params.baseline_fname)
+                n_regressions += check_baseline (&params, &baseline, &configs [i], &result);
+
+            free (result.samples);
+        }
+    }
+
+    if (csv_file)
+        fclose (csv_file);
+
+    free (configs);
+
+    if (params.baseline_fname)
+    {
+        free_baseline (&baseline);
+
+        if (n_regressions)
+        {
+            printf ("%d regression(s) beyond %.1f%% tolerance.\n",
+                    n_regressions, params.tolerance_pct);
+            return EXIT_REGRESSION;
+        }
+
+        printf ("No regressions beyond %.1f%% tolerance.\n", params.tolerance_pct);
+    }
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* Copyright © 2019-2023 Hans Petter Jansson. See COPYING for details. */
+
+/* Differential tester. Scales randomized images with each available
+ * implementation forced in turn, and checks that the outputs are identical
+ * to those of the generic implementation, bit for bit. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "smolscale.h"
+
+#define DEFAULT_N_ITERATIONS 2000
+
+/* Keeps each iteration fast while still reaching the box filter */
+#define MAX_PIXELS_IN (1 << 20)
+
+static const char * const impl_names [] = { "generic", "avx2" };
+
+#define N_IMPLS ((int) (sizeof (impl_names) / sizeof (impl_names [0])))
+
+typedef struct
+{
+    const char *name;
+    int n_channels;
+    int alpha_index;  /* -1 if opaque */
+    int premul;
+}
+PixelInfo;
+
+static const PixelInfo pixel_info [SMOL_PIXEL_MAX] =
+{
+    { "RGBA8_PREMULTIPLIED", 4, 3, 1 },
+    { "BGRA8_PREMULTIPLIED", 4, 3, 1 },
+    { "ARGB8_PREMULTIPLIED", 4, 0, 1 },
+    { "ABGR8_PREMULTIPLIED", 4, 0, 1 },
+    { "RGBA8_UNASSOCIATED", 4, 3, 0 },
+    { "BGRA8_UNASSOCIATED", 4, 3, 0 },
+    { "ARGB8_UNASSOCIATED", 4, 0, 0 },
+    { "ABGR8_UNASSOCIATED", 4, 0, 0 },
+    { "RGB8", 3, -1, 0 },
+    { "BGR8", 3, -1, 0 }
+};
+
+typedef struct
+{
+    SmolPixelType type_in, type_out;
+    uint32_t width_in, height_in, rowstride_in;
+    uint32_t width_out, height_out, rowstride_out;
+    uint32_t misalign;
+    uint8_t with_srgb;
+}
+TestCase;
+
+/* --- Random numbers --- */
+
+static uint64_t rand_state;
+
+static uint32_t
+rand_u32 (void)
+{
+    /* xorshift64* */
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return (rand_state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static uint32_t
+rand_range (uint32_t min, uint32_t max)
+{
+    return min + rand_u32 () % (max - min + 1);
+}
+
+/* Picks a pair of dimensions that exercises a randomly chosen filter */
+static void
+pick_dims (uint32_t *dim_in, uint32_t *dim_out)
+{
+    switch (rand_u32 () % 6)
+    {
+        case 0:
+            /* Copy */
+            *dim_in = *dim_out = rand_range (1, 600);
+            break;
+        case 1:
+            /* One */
+            *dim_in = 1;
+            *dim_out = rand_range (1, 600);
+            break;
+        case 2:
+            /* Upscale */
+            *dim_in = rand_range (2, 300);
+            *dim_out = rand_range (*dim_in, 900);
+            break;
+        case 3:
+            /* Bilinear downscale, with halvings */
+            *dim_out = rand_range (1, 200);
+            *dim_in = rand_range (*dim_out + 1, *dim_out * 8);
+            break;
+        case 4:
+            /* Box */
+            *dim_out = rand_range (1, 60);
+            *dim_in = rand_range (*dim_out * 8 + 1, *dim_out * 255);
+            break;
+        default:
+            /* Box at 128bpp */
+            *dim_out = rand_range (1, 4);
+            *dim_in = rand_range (*dim_out * 255 + 1, *dim_out * 1024);
+            break;
+    }
+}
+
+static void
+pick_case (TestCase *test)
+{
+    test->type_in = rand_u32 () % SMOL_PIXEL_MAX;
+    test->type_out = rand_u32 () % SMOL_PIXEL_MAX;
+    test->with_srgb = rand_u32 () & 1;
+
+    do
+    {
+        pick_dims (&test->width_in, &test->width_out);
+        pick_dims (&test->height_in, &test->height_out);
+    }
+    while ((uint64_t) test->width_in * test->height_in > MAX_PIXELS_IN
+           || (uint64_t) test->width_out * test->height_out > MAX_PIXELS_IN);
+
+    /* Sometimes pad the rows, and sometimes misalign the input */
+    test->rowstride_in = test->width_in * pixel_info [test->type_in].n_channels
+        + (rand_u32 () % 4 == 0 ? rand_range (1, 64) : 0);
+    test->rowstride_out = test->width_out * pixel_info [test->type_out].n_channels
+        + (rand_u32 () % 4 == 0 ? rand_range (1, 64) : 0);
+    test->misalign = rand_u32 () % 4 == 0 ? rand_range (1, 15) : 0;
+}
+
+/* Fills the image with random pixels. Premultiplied colors are kept within
+ * alpha, so the input is valid. Extreme values are favored to stress
+ * saturation and rounding. */
+static void
+fill_pixels (uint8_t *pixels, const TestCase *test)
+{
+    const PixelInfo *pinfo = &pixel_info [test->type_in];
+    uint32_t x, y;
+    int c;
+
+    for (y = 0; y < test->height_in; y++)
+    {
+        uint8_t *p = pixels + y * test->rowstride_in;
+
+        for (x = 0; x < test->width_in; x++)
+        {
+            uint8_t alpha = 0xff;
+
+            if (pinfo->alpha_index >= 0)
+            {
+                switch (rand_u32 () % 4)
+                {
+                    case 0: alpha = 0x00; break;
+                    case 1: alpha = 0xff; break;
+                    default: alpha = rand_u32 (); break;
+                }
+
+                p [pinfo->alpha_index] = alpha;
+            }
+
+            for (c = 0; c < pinfo->n_channels; c++)
+            {
+                if (c == pinfo->alpha_index)
+                    continue;
+
+                p [c] = rand_u32 ();
+                if (pinfo->premul)
+                    p [c] = (p [c] * (alpha + 1)) >> 8;
+            }
+
+            p += pinfo->n_channels;
+        }
+    }
+}
+
+static void
+print_case (const TestCase *test)
+{
+    fprintf (stderr, "  %s %ux%u (stride %u, misalign %u) -> %s %ux%u (stride %u), srgb %s\n",
+             pixel_info [test->type_in].name,
+             test->width_in, test->height_in, test->rowstride_in, test->misalign,
+             pixel_info [test->type_out].name,
+             test->width_out, test->height_out, test->rowstride_out,
+             test->with_srgb ? "on" : "off");
+}
+
+static int
+compare_outputs (const TestCase *test, const char *impl_name,
+                 const uint8_t *reference, const uint8_t *out)
+{
+    int n_channels = pixel_info [test->type_out].n_channels;
+    uint32_t x, y;
+    int c;
+
+    for (y = 0; y < test->height_out; y++)
+    {
+        const uint8_t *r = reference + y * test->rowstride_out;
+        const uint8_t *o = out + y * test->rowstride_out;
+
+        if (!memcmp (r, o, test->width_out * n_channels))
+            continue;
+
+        for (x = 0; x < test->width_out; x++)
+        {
+            if (!memcmp (r + x * n_channels, o + x * n_channels, n_channels))
+                continue;
+
+            fprintf (stderr, "Mismatch between generic and %s at (%u, %u):", impl_name, x, y);
+            for (c = 0; c < n_channels; c++)
+                fprintf (stderr, " %02x/%02x", r [x * n_channels + c], o [x * n_channels + c]);
+            fprintf (stderr, "\n");
+            print_case (test);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+scale_with (const char *impl_name, const TestCase *test,
+            const uint8_t *pixels_in, uint8_t *pixels_out)
+{
+    if (!smol_set_implementation (impl_name))
+        abort ();
+
+    smol_scale_simple (pixels_in, test->type_in,
+                       test->width_in, test->height_in, test->rowstride_in,
+                       pixels_out, test->type_out,
+                       test->width_out, test->height_out, test->rowstride_out,
+                       test->with_srgb);
+}
+
+/* Returns the number of implementations that differed from generic */
+static int
+run_case (const TestCase *test, int n_impls, const char * const *impls)
+{
+    size_t size_in = (size_t) test->rowstride_in * test->height_in;
+    size_t size_out = (size_t) test->rowstride_out * test->height_out;
+    uint8_t *storage_in, *pixels_in;
+    uint8_t *reference, *out;
+    int n_failed = 0;
+    int i;
+
+    storage_in = malloc (size_in + test->misalign);
+    pixels_in = storage_in + test->misalign;
+    reference = calloc (1, size_out);
+    out = calloc (1, size_out);
+
+    fill_pixels (pixels_in, test);
+    scale_with ("generic", test, pixels_in, reference);
+
+    for (i = 0; i < n_impls; i++)
+    {
+        memset (out, 0, size_out);
+        scale_with (impls [i], test, pixels_in, out);
+        n_failed += compare_outputs (test, impls [i], reference, out);
+    }
+
+    free (out);
+    free (reference);
+    free (storage_in);
+
+    return n_failed;
+}
+
+static void
+print_usage (const char *argv0)
+{
+    printf ("Usage: %s [-n ITERATIONS] [-s SEED]\n\n"
+            "Scales random images with each available implementation and\n"
+            "checks that the outputs match the generic implementation exactly.\n",
+            argv0);
+}
+
+int
+main (int argc, char *argv [])
+{
+    const char *impls [N_IMPLS];
+    unsigned long n_iterations = DEFAULT_N_ITERATIONS;
+    unsigned long seed = 1;
+    unsigned long i;
+    int n_impls = 0;
+    int n_failed = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "hn:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                n_iterations = strtoul (optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoul (optarg, NULL, 0);
+                break;
+            case 'h':
+                print_usage (argv [0]);
+                return 0;
+            default:
+                print_usage (argv [0]);
+                return 1;
+        }
+    }
+
+    /* Generic is the reference */
+    for (opt = 1; opt < N_IMPLS; opt++)
+    {
+        if (smol_set_implementation (impl_names [opt]))
+            impls [n_impls++] = impl_names [opt];
+        else
+            printf ("Implementation '%s' is not available, skipping.\n", impl_names [opt]);
+    }
+
+    if (n_impls == 0)
+    {
+        printf ("Nothing to compare against.\n");
+        return 0;
+    }
+
+    rand_state = seed * 0x9e3779b97f4a7c15ULL + 1;
+
+    for (i = 0; i < n_iterations && n_failed < 10; i++)
+    {
+        TestCase test;
+
+        pick_case (&test);
+        n_failed += run_case (&test, n_impls, impls);
+    }
+
+    smol_set_implementation (NULL);
+
+    printf ("%lu cases, %d mismatches (seed %lu).\n", i, n_failed, seed);
+    return n_failed ? 1 : 0;
+}
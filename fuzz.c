@@ -0,0 +1,339 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* Copyright © 2019-2023 Hans Petter Jansson. See COPYING for details. */
+
+/* Fuzzing harness. Decodes geometry, strides, alignment, pixel types and the
+ * API entry point to use from the input, then scales an image of that shape.
+ * Buffers are allocated to the exact size the parameters call for, so the
+ * sanitizers catch any access beyond them.
+ *
+ * Built with -DSMOL_FUZZ_LIBFUZZER, this is a libFuzzer target. Otherwise it
+ * is a standalone program that runs each file given on the command line, or
+ * stdin if there are none, which is what AFL expects. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smolscale.h"
+
+/* Caps on dimensions and pixel counts, to keep each run fast */
+#define MAX_DIM 4096
+#define MAX_PIXELS (1 << 20)
+
+#define MAX_MISALIGN 64
+
+typedef enum
+{
+    FUZZ_MODE_SIMPLE,
+    FUZZ_MODE_BATCH,
+    FUZZ_MODE_SCRATCH,
+    FUZZ_MODE_SINK,
+
+    FUZZ_MODE_MAX
+}
+FuzzMode;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t ofs;
+}
+Reader;
+
+typedef struct
+{
+    uint32_t width_out;
+    uint32_t n_bytes_per_row;
+}
+RowCheck;
+
+static const char * const impl_names [] = { "auto", "generic", "avx2" };
+
+static uint32_t
+read_u8 (Reader *reader)
+{
+    if (reader->ofs >= reader->size)
+        return 0;
+
+    return reader->data [reader->ofs++];
+}
+
+static uint32_t
+read_u16 (Reader *reader)
+{
+    uint32_t v = read_u8 (reader);
+
+    return v | (read_u8 (reader) << 8);
+}
+
+static uint32_t
+get_bytes_per_pixel (SmolPixelType type)
+{
+    return type >= SMOL_PIXEL_RGB8 ? 3 : 4;
+}
+
+/* Includes the padding of all rows but the last, which is how much
+ * memory callers are obliged to provide */
+static size_t
+get_image_size (uint32_t width, uint32_t height, uint32_t rowstride, SmolPixelType type)
+{
+    return (size_t) rowstride * (height - 1) + (size_t) width * get_bytes_per_pixel (type);
+}
+
+/* Pixel contents come from the rest of the input, repeated as needed */
+static void
+fill_pixels (uint8_t *pixels, size_t n_bytes, const Reader *reader)
+{
+    size_t n_data = reader->size - reader->ofs;
+    size_t i;
+
+    if (n_data == 0)
+    {
+        memset (pixels, 0x80, n_bytes);
+        return;
+    }
+
+    for (i = 0; i < n_bytes; i++)
+        pixels [i] = reader->data [reader->ofs + i % n_data];
+}
+
+/* Touches the whole row, so a short row is caught here */
+static void
+post_row (uint32_t *row_inout, int width, void *user_data)
+{
+    const RowCheck *check = user_data;
+    uint8_t *p = (uint8_t *) row_inout;
+    uint32_t i;
+
+    if ((uint32_t) width != check->width_out)
+        abort ();
+
+    for (i = 0; i < check->n_bytes_per_row; i++)
+        p [i] ^= 0x55;
+}
+
+static void
+sink_row (const void *row_out, uint32_t outrow_index, uint32_t width, void *user_data)
+{
+    const RowCheck *check = user_data;
+    const uint8_t *p = row_out;
+    volatile uint8_t sum = 0;
+    uint32_t i;
+
+    (void) outrow_index;
+
+    if (width != check->width_out)
+        abort ();
+
+    for (i = 0; i < check->n_bytes_per_row; i++)
+        sum += p [i];
+}
+
+static void
+run_batches (const SmolScaleCtx *scale_ctx, FuzzMode mode,
+             uint32_t height_out, uint32_t batch_n_rows,
+             void *scratch, void *pixels_out, RowCheck *check)
+{
+    uint32_t first_row;
+
+    for (first_row = 0; first_row < height_out; first_row += batch_n_rows)
+    {
+        uint32_t n_rows = height_out - first_row;
+
+        if (n_rows > batch_n_rows)
+            n_rows = batch_n_rows;
+
+        switch (mode)
+        {
+            case FUZZ_MODE_BATCH:
+                smol_scale_batch (scale_ctx, first_row, n_rows);
+                break;
+            case FUZZ_MODE_SCRATCH:
+                smol_scale_batch_with_scratch (scale_ctx, scratch, pixels_out, first_row, n_rows);
+                break;
+            case FUZZ_MODE_SINK:
+                smol_scale_batch_to_sink (scale_ctx, scratch, first_row, n_rows, sink_row, check);
+                break;
+            default:
+                abort ();
+        }
+    }
+}
+
+static void
+run_input (const uint8_t *data, size_t size)
+{
+    Reader reader = { data, size, 0 };
+    uint32_t width_in, height_in, width_out, height_out;
+    uint32_t rowstride_in, rowstride_out;
+    uint32_t misalign_in, misalign_out;
+    uint32_t batch_n_rows;
+    SmolPixelType type_in, type_out;
+    uint8_t with_srgb;
+    FuzzMode mode;
+    uint32_t flags;
+    size_t size_in, size_out;
+    uint8_t *storage_in, *storage_out, *pixels_in, *pixels_out;
+    RowCheck check;
+
+    width_in = read_u16 (&reader) % MAX_DIM + 1;
+    height_in = read_u16 (&reader) % MAX_DIM + 1;
+    width_out = read_u16 (&reader) % MAX_DIM + 1;
+    height_out = read_u16 (&reader) % MAX_DIM + 1;
+
+    if ((uint64_t) width_in * height_in > MAX_PIXELS
+        || (uint64_t) width_out * height_out > MAX_PIXELS)
+        return;
+
+    type_in = read_u8 (&reader) % SMOL_PIXEL_MAX;
+    type_out = read_u8 (&reader) % SMOL_PIXEL_MAX;
+
+    flags = read_u8 (&reader);
+    with_srgb = flags & 1;
+    mode = (flags >> 1) % FUZZ_MODE_MAX;
+
+    /* Fall back to automatic selection if the host can't run the pick */
+    if (!smol_set_implementation (impl_names [(flags >> 3) % 3]))
+        smol_set_implementation (NULL);
+
+    rowstride_in = width_in * get_bytes_per_pixel (type_in) + read_u8 (&reader);
+    rowstride_out = width_out * get_bytes_per_pixel (type_out) + read_u8 (&reader);
+    misalign_in = read_u8 (&reader) % MAX_MISALIGN;
+    misalign_out = read_u8 (&reader) % MAX_MISALIGN;
+    batch_n_rows = read_u8 (&reader) + 1;
+
+    /* 32-bit output rows must be aligned, per the API */
+    if (get_bytes_per_pixel (type_out) == 4)
+    {
+        rowstride_out = (rowstride_out + 3) & ~3U;
+        misalign_out &= ~3U;
+    }
+
+    size_in = get_image_size (width_in, height_in, rowstride_in, type_in);
+    size_out = get_image_size (width_out, height_out, rowstride_out, type_out);
+
+    /* The misalignment is taken off the front, so the buffer still ends
+     * exactly where the image does */
+    storage_in = malloc (size_in + misalign_in);
+    storage_out = malloc (size_out + misalign_out);
+    pixels_in = storage_in + misalign_in;
+    pixels_out = storage_out + misalign_out;
+
+    fill_pixels (pixels_in, size_in, &reader);
+
+    check.width_out = width_out;
+    check.n_bytes_per_row = width_out * get_bytes_per_pixel (type_out);
+
+    if (mode == FUZZ_MODE_SIMPLE)
+    {
+        smol_scale_simple (pixels_in, type_in, width_in, height_in, rowstride_in,
+                           pixels_out, type_out, width_out, height_out, rowstride_out,
+                           with_srgb);
+    }
+    else if (mode == FUZZ_MODE_BATCH)
+    {
+        SmolScaleCtx *scale_ctx;
+
+        scale_ctx = smol_scale_new_full (pixels_in, type_in, width_in, height_in, rowstride_in,
+                                         pixels_out, type_out, width_out, height_out, rowstride_out,
+                                         with_srgb, post_row, &check);
+        run_batches (scale_ctx, mode, height_out, batch_n_rows, NULL, NULL, &check);
+        smol_scale_destroy (scale_ctx);
+    }
+    else
+    {
+        SmolScaleCtx *scale_ctx;
+        size_t ctx_size;
+        void *ctx_storage, *scratch;
+
+        /* Context and scratch sizes are exact too */
+        ctx_size = smol_scale_ctx_size (width_in, height_in, width_out, height_out);
+        ctx_storage = malloc (ctx_size);
+        scale_ctx = smol_scale_init_in_storage (ctx_storage, ctx_size,
+                                                pixels_in, type_in, width_in, height_in, rowstride_in,
+                                                mode == FUZZ_MODE_SINK ? NULL : pixels_out,
+                                                type_out, width_out, height_out, rowstride_out,
+                                                with_srgb, NULL, NULL);
+        if (!scale_ctx)
+            abort ();
+
+        scratch = malloc (smol_scale_get_scratch_size (scale_ctx));
+        run_batches (scale_ctx, mode, height_out, batch_n_rows, scratch, pixels_out, &check);
+
+        free (scratch);
+        free (ctx_storage);
+    }
+
+    free (storage_out);
+    free (storage_in);
+}
+
+#ifdef SMOL_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+    run_input (data, size);
+    return 0;
+}
+
+#else
+
+static int
+run_file (FILE *file)
+{
+    uint8_t *data = NULL;
+    size_t size = 0, alloc_size = 0;
+    size_t n;
+
+    for (;;)
+    {
+        if (size == alloc_size)
+        {
+            alloc_size = alloc_size ? alloc_size * 2 : 65536;
+            data = realloc (data, alloc_size);
+        }
+
+        n = fread (data + size, 1, alloc_size - size, file);
+        if (n == 0)
+            break;
+        size += n;
+    }
+
+    run_input (data, size);
+    free (data);
+
+    return ferror (file) ? 1 : 0;
+}
+
+int
+main (int argc, char *argv [])
+{
+    int result = 0;
+    int i;
+
+    if (argc < 2)
+        return run_file (stdin);
+
+    for (i = 1; i < argc; i++)
+    {
+        FILE *file = fopen (argv [i], "rb");
+
+        if (!file)
+        {
+            fprintf (stderr, "Could not open '%s'.\n", argv [i]);
+            result = 1;
+            continue;
+        }
+
+        result |= run_file (file);
+        fclose (file);
+    }
+
+    return result;
+}
+
+#endif
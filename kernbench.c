@@ -0,0 +1,569 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* Copyright © 2019-2023 Hans Petter Jansson. See COPYING for details. */
+
+/* Kernel micro-benchmark. Calls the filter and repack entries of each
+ * SmolImplementation directly on small, cache-resident buffers, so SIMD work
+ * can be measured without whole-image noise. Uses the private API and has to
+ * be rebuilt along with Smolscale.
+ *
+ * Vertical filters are timed by producing the same output row repeatedly.
+ * For bilinear and copy filters that reuses cached input rows, so mostly
+ * vertical work is measured; box and halving filters still pull in the
+ * horizontal work for the rows they consume. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "smolscale-private.h"
+
+/* Output width of filter kernels, and pixels per repack call */
+#define KERNEL_WIDTH 256
+
+/* Output height for vertical filters */
+#define KERNEL_HEIGHT 4
+
+#define MIN_RUN_NS 1000000.0
+#define N_RUNS 5
+
+typedef enum
+{
+    IMPL_GENERIC,
+    IMPL_AVX2,
+
+    IMPL_MAX
+}
+ImplIndex;
+
+static const char * const impl_names [IMPL_MAX] = { "generic", "avx2" };
+
+static const char * const filter_names [SMOL_FILTER_MAX] =
+{
+    "copy", "one",
+    "bilinear-0h", "bilinear-1h", "bilinear-2h", "bilinear-3h",
+    "bilinear-4h", "bilinear-5h", "bilinear-6h",
+    "box"
+};
+
+static const char * const storage_names [SMOL_STORAGE_MAX] = { "24", "32", "64", "128" };
+static const char * const alpha_names [SMOL_ALPHA_MAX] = { "unassoc", "premul8", "premul16" };
+static const char * const gamma_names [SMOL_GAMMA_MAX] = { "srgb", "linear" };
+
+typedef enum
+{
+    KERNEL_HFILTER,
+    KERNEL_VFILTER,
+    KERNEL_REPACK
+}
+KernelType;
+
+typedef struct
+{
+    KernelType type;
+    SmolScaleCtx *scale_ctx;
+    SmolVerticalCtx *vertical_ctx;
+    SmolRepackRowFunc *repack_row_func;
+    const void *in;
+    void *out;
+}
+Kernel;
+
+/* Signature fields, as laid out by SMOL_REPACK_META */
+#define SIG_REORDER(sig) ((sig) >> 10)
+#define SIG_STORAGE_IN(sig) (((sig) >> 8) & 3)
+#define SIG_ALPHA_IN(sig) (((sig) >> 6) & 3)
+#define SIG_GAMMA_IN(sig) (((sig) >> 5) & 1)
+#define SIG_STORAGE_OUT(sig) (((sig) >> 3) & 3)
+#define SIG_ALPHA_OUT(sig) (((sig) >> 1) & 3)
+#define SIG_GAMMA_OUT(sig) ((sig) & 1)
+#define SIG_ANY_ORDER(sig) ((sig) & 0x3ff)
+
+static double
+get_time_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *
+alloc_aligned (size_t size)
+{
+    return aligned_alloc (SMOL_ALIGNMENT, SMOL_ALIGN_UP (size, SMOL_ALIGNMENT));
+}
+
+static void *
+kernel_alloc (size_t size, void *user_data)
+{
+    (void) user_data;
+    return malloc (size);
+}
+
+static void
+kernel_free (void *p, void *user_data)
+{
+    (void) user_data;
+    free (p);
+}
+
+/* For buffers the kernels allocate on their own, like the alignment buffer */
+static const SmolAllocator kernel_allocator = { kernel_alloc, kernel_free, NULL, NULL };
+
+/* Every channel equals alpha, which is valid for all alpha types and
+ * channel orders */
+static void
+fill_pixels (uint8_t *buf, uint32_t n_bytes, uint32_t bytes_per_pixel)
+{
+    uint32_t seed = 0x12345678;
+    uint32_t i, j;
+
+    for (i = 0; i + bytes_per_pixel <= n_bytes; i += bytes_per_pixel)
+    {
+        seed = seed * 1103515245 + 12345;
+
+        for (j = 0; j < bytes_per_pixel; j++)
+            buf [i + j] = seed >> 24;
+    }
+}
+
+static uint32_t
+get_storage_bytes (SmolStorageType storage)
+{
+    static const uint32_t bytes [SMOL_STORAGE_MAX] = { 3, 4, 8, 16 };
+
+    return bytes [storage];
+}
+
+static const SmolRepackMeta *
+find_repack (const SmolImplementation *impl,
+             SmolStorageType storage_in, SmolAlphaType alpha_in, SmolGammaType gamma_in,
+             SmolStorageType storage_out, SmolAlphaType alpha_out, SmolGammaType gamma_out)
+{
+    const SmolRepackMeta *meta;
+
+    for (meta = impl->repack_meta; meta->repack_row_func; meta++)
+    {
+        if (SIG_STORAGE_IN (meta->signature) == storage_in
+            && SIG_ALPHA_IN (meta->signature) == alpha_in
+            && SIG_GAMMA_IN (meta->signature) == gamma_in
+            && SIG_STORAGE_OUT (meta->signature) == storage_out
+            && SIG_ALPHA_OUT (meta->signature) == alpha_out
+            && SIG_GAMMA_OUT (meta->signature) == gamma_out)
+            return meta;
+    }
+
+    return NULL;
+}
+
+static void
+run_kernel (Kernel *kernel)
+{
+    SmolScaleCtx *scale_ctx = kernel->scale_ctx;
+
+    switch (kernel->type)
+    {
+        case KERNEL_HFILTER:
+            scale_ctx->hfilter_func (scale_ctx, kernel->in, kernel->out);
+            break;
+        case KERNEL_VFILTER:
+            scale_ctx->vfilter_func (scale_ctx, kernel->vertical_ctx, 0, kernel->out);
+            break;
+        case KERNEL_REPACK:
+            kernel->repack_row_func (kernel->in, kernel->out, KERNEL_WIDTH);
+            break;
+    }
+}
+
+/* Returns the best time per call out of N_RUNS */
+static double
+time_kernel (Kernel *kernel)
+{
+    uint32_t n_calls = 1;
+    double best_ns = 0.0;
+    double t0;
+    uint32_t i, j;
+
+    /* Warm up and scale the run length */
+    for (;;)
+    {
+        t0 = get_time_ns ();
+        for (i = 0; i < n_calls; i++)
+            run_kernel (kernel);
+        if (get_time_ns () - t0 >= MIN_RUN_NS)
+            break;
+        n_calls *= 2;
+    }
+
+    for (j = 0; j < N_RUNS; j++)
+    {
+        double ns;
+
+        t0 = get_time_ns ();
+        for (i = 0; i < n_calls; i++)
+            run_kernel (kernel);
+        ns = (get_time_ns () - t0) / n_calls;
+
+        if (j == 0 || ns < best_ns)
+            best_ns = ns;
+    }
+
+    return best_ns;
+}
+
+static uint32_t
+get_dim_in (SmolFilterType filter, uint32_t dim_out)
+{
+    if (filter == SMOL_FILTER_COPY)
+        return dim_out;
+    if (filter == SMOL_FILTER_ONE)
+        return 1;
+    if (filter == SMOL_FILTER_BOX)
+        return dim_out * 16;
+
+    /* Bilinear, halfway between this number of halvings and the next */
+    return (dim_out << (filter - SMOL_FILTER_BILINEAR_0H)) * 3 / 2;
+}
+
+/* Sets up a context the way smol_scale_init() would, but with the filter
+ * given instead of picked. This reaches the bilinear variants with more
+ * halvings than pick_filter_params() ever uses. */
+static int
+init_kernel_ctx (SmolScaleCtx *scale_ctx,
+                 const SmolImplementation *impl,
+                 SmolStorageType storage,
+                 SmolFilterType filter_h,
+                 SmolFilterType filter_v)
+{
+    const SmolImplementation *generic = _smol_get_generic_implementation ();
+    SmolGammaType gamma = storage == SMOL_STORAGE_128BPP
+        ? SMOL_GAMMA_SRGB_LINEAR : SMOL_GAMMA_SRGB_COMPRESSED;
+    const SmolRepackMeta *unpack, *pack;
+    uint32_t precalc_size;
+
+    memset (scale_ctx, 0, sizeof (*scale_ctx));
+
+    scale_ctx->allocator = kernel_allocator;
+    scale_ctx->pixel_type_in = SMOL_PIXEL_RGBA8_PREMULTIPLIED;
+    scale_ctx->pixel_type_out = SMOL_PIXEL_RGBA8_PREMULTIPLIED;
+    scale_ctx->storage_type = storage;
+    scale_ctx->gamma_type = gamma;
+    scale_ctx->filter_h = filter_h;
+    scale_ctx->filter_v = filter_v;
+
+    scale_ctx->width_out = KERNEL_WIDTH;
+    scale_ctx->width_in = get_dim_in (filter_h, KERNEL_WIDTH);
+    scale_ctx->width_bilin_out = KERNEL_WIDTH;
+    scale_ctx->height_out = filter_v == SMOL_FILTER_COPY ? 1 : KERNEL_HEIGHT;
+    scale_ctx->height_in = get_dim_in (filter_v, scale_ctx->height_out);
+    scale_ctx->height_bilin_out = scale_ctx->height_out;
+
+    if (filter_h >= SMOL_FILTER_BILINEAR_0H && filter_h <= SMOL_FILTER_BILINEAR_6H)
+    {
+        scale_ctx->width_halvings = filter_h - SMOL_FILTER_BILINEAR_0H;
+        scale_ctx->width_bilin_out <<= scale_ctx->width_halvings;
+    }
+
+    if (filter_v >= SMOL_FILTER_BILINEAR_0H && filter_v <= SMOL_FILTER_BILINEAR_6H)
+    {
+        scale_ctx->height_halvings = filter_v - SMOL_FILTER_BILINEAR_0H;
+        scale_ctx->height_bilin_out <<= scale_ctx->height_halvings;
+    }
+
+    scale_ctx->rowstride_in = scale_ctx->width_in * sizeof (uint32_t);
+    scale_ctx->rowstride_out = scale_ctx->width_out * sizeof (uint32_t);
+
+    precalc_size = ((scale_ctx->width_bilin_out + 1) * 2
+                    + (scale_ctx->height_bilin_out + 1) * 2) * sizeof (uint16_t);
+    scale_ctx->precalc_x = alloc_aligned (precalc_size);
+    scale_ctx->precalc_y = scale_ctx->precalc_x + (scale_ctx->width_bilin_out + 1) * 2;
+
+    scale_ctx->hfilter_func = impl->hfilter_funcs [storage] [filter_h];
+    scale_ctx->vfilter_func = impl->vfilter_funcs [storage] [filter_v];
+
+    /* Repacks may come from the generic implementation, as they would in
+     * get_implementations() */
+    unpack = find_repack (impl, SMOL_STORAGE_32BPP, SMOL_ALPHA_PREMUL8, SMOL_GAMMA_SRGB_COMPRESSED,
+                          storage, SMOL_ALPHA_PREMUL8, gamma);
+    if (!unpack)
+        unpack = find_repack (generic, SMOL_STORAGE_32BPP, SMOL_ALPHA_PREMUL8, SMOL_GAMMA_SRGB_COMPRESSED,
+                              storage, SMOL_ALPHA_PREMUL8, gamma);
+    pack = find_repack (impl, storage, SMOL_ALPHA_PREMUL8, gamma,
+                        SMOL_STORAGE_32BPP, SMOL_ALPHA_PREMUL8, SMOL_GAMMA_SRGB_COMPRESSED);
+    if (!pack)
+        pack = find_repack (generic, storage, SMOL_ALPHA_PREMUL8, gamma,
+                            SMOL_STORAGE_32BPP, SMOL_ALPHA_PREMUL8, SMOL_GAMMA_SRGB_COMPRESSED);
+
+    if (!scale_ctx->hfilter_func || !scale_ctx->vfilter_func || !unpack || !pack)
+    {
+        free (scale_ctx->precalc_x);
+        return 0;
+    }
+
+    scale_ctx->unpack_row_func = unpack->repack_row_func;
+    scale_ctx->pack_row_func = pack->repack_row_func;
+
+    if (impl->init_h_func)
+        impl->init_h_func (scale_ctx);
+    if (impl->init_v_func)
+        impl->init_v_func (scale_ctx);
+
+    return 1;
+}
+
+static uint32_t
+get_row_size (const SmolScaleCtx *scale_ctx)
+{
+    return MAX (scale_ctx->width_in, scale_ctx->width_bilin_out)
+        * get_storage_bytes (scale_ctx->storage_type);
+}
+
+/* Returns time per output pixel, or a negative value if the filter is
+ * missing from the implementation */
+static double
+time_hfilter (const SmolImplementation *impl,
+              SmolStorageType storage,
+              SmolFilterType filter)
+{
+    SmolScaleCtx scale_ctx;
+    uint32_t *pixels;
+    void *unpacked, *out;
+    Kernel kernel;
+    double ns;
+
+    if (!init_kernel_ctx (&scale_ctx, impl, storage, filter, SMOL_FILTER_COPY))
+        return -1.0;
+
+    pixels = alloc_aligned (scale_ctx.width_in * sizeof (uint32_t));
+    unpacked = alloc_aligned (get_row_size (&scale_ctx));
+    out = alloc_aligned (get_row_size (&scale_ctx));
+
+    fill_pixels ((uint8_t *) pixels, scale_ctx.width_in * sizeof (uint32_t), 4);
+    scale_ctx.unpack_row_func (pixels, unpacked, scale_ctx.width_in);
+
+    kernel.type = KERNEL_HFILTER;
+    kernel.scale_ctx = &scale_ctx;
+    kernel.in = unpacked;
+    kernel.out = out;
+
+    ns = time_kernel (&kernel);
+
+    free (out);
+    free (unpacked);
+    free (pixels);
+    free (scale_ctx.precalc_x);
+
+    return ns / scale_ctx.width_out;
+}
+
+static double
+time_vfilter (const SmolImplementation *impl,
+              SmolStorageType storage,
+              SmolFilterType filter)
+{
+    SmolScaleCtx scale_ctx;
+    SmolVerticalCtx vertical_ctx;
+    uint32_t n_bytes_in;
+    void *pixels, *out;
+    Kernel kernel;
+    double ns;
+    int i;
+
+    if (!init_kernel_ctx (&scale_ctx, impl, storage, SMOL_FILTER_COPY, filter))
+        return -1.0;
+
+    n_bytes_in = scale_ctx.rowstride_in * scale_ctx.height_in;
+    pixels = alloc_aligned (n_bytes_in);
+    out = alloc_aligned (scale_ctx.rowstride_out);
+    fill_pixels (pixels, n_bytes_in, 4);
+    scale_ctx.pixels_in = pixels;
+
+    memset (&vertical_ctx, 0, sizeof (vertical_ctx));
+    vertical_ctx.in_ofs = UINT_MAX - 1;
+    for (i = 0; i < 4; i++)
+        vertical_ctx.parts_row [i] = alloc_aligned (get_row_size (&scale_ctx));
+
+    kernel.type = KERNEL_VFILTER;
+    kernel.scale_ctx = &scale_ctx;
+    kernel.vertical_ctx = &vertical_ctx;
+    kernel.out = out;
+
+    ns = time_kernel (&kernel);
+
+    for (i = 0; i < 4; i++)
+        free (vertical_ctx.parts_row [i]);
+    if (vertical_ctx.in_aligned_storage)
+        smol_free (&scale_ctx.allocator, vertical_ctx.in_aligned_storage);
+    free (out);
+    free (pixels);
+    free (scale_ctx.precalc_x);
+
+    return ns / scale_ctx.width_out;
+}
+
+/* Internal formats can hold values that would index past the end of lookup
+ * tables, so those inputs are made by unpacking valid pixels */
+static int
+make_repack_input (const SmolImplementation *impl, uint16_t signature, void *in)
+{
+    SmolStorageType storage = SIG_STORAGE_IN (signature);
+    const SmolRepackMeta *unpack;
+    uint8_t *pixels;
+
+    if (storage == SMOL_STORAGE_24BPP || storage == SMOL_STORAGE_32BPP)
+    {
+        fill_pixels (in, KERNEL_WIDTH * get_storage_bytes (storage), get_storage_bytes (storage));
+        return 1;
+    }
+
+    unpack = find_repack (impl, SMOL_STORAGE_32BPP,
+                          SIG_ALPHA_IN (signature) == SMOL_ALPHA_PREMUL16
+                          ? SMOL_ALPHA_UNASSOCIATED : SMOL_ALPHA_PREMUL8,
+                          SMOL_GAMMA_SRGB_COMPRESSED,
+                          storage, SIG_ALPHA_IN (signature), SIG_GAMMA_IN (signature));
+    if (!unpack)
+        return 0;
+
+    pixels = alloc_aligned (KERNEL_WIDTH * 4);
+    fill_pixels (pixels, KERNEL_WIDTH * 4, 4);
+    unpack->repack_row_func (pixels, in, KERNEL_WIDTH);
+    free (pixels);
+
+    return 1;
+}
+
+/* Returns time per pixel */
+static double
+time_repack (const SmolImplementation *impl, const SmolRepackMeta *meta)
+{
+    Kernel kernel;
+    void *in, *out;
+    double ns = -1.0;
+
+    in = alloc_aligned (KERNEL_WIDTH * 16);
+    out = alloc_aligned (KERNEL_WIDTH * 16);
+
+    if (make_repack_input (impl, meta->signature, in))
+    {
+        kernel.type = KERNEL_REPACK;
+        kernel.repack_row_func = meta->repack_row_func;
+        kernel.in = in;
+        kernel.out = out;
+
+        ns = time_kernel (&kernel) / KERNEL_WIDTH;
+    }
+
+    free (out);
+    free (in);
+
+    return ns;
+}
+
+static void
+print_row (const char *name, const double *ns)
+{
+    int i;
+
+    printf ("%-52s", name);
+
+    for (i = 0; i < IMPL_MAX; i++)
+    {
+        if (ns [i] < 0.0)
+            printf (" %8s", "-");
+        else
+            printf (" %8.3f", ns [i]);
+    }
+
+    if (ns [IMPL_GENERIC] > 0.0 && ns [IMPL_AVX2] > 0.0)
+        printf (" %8.2f", ns [IMPL_GENERIC] / ns [IMPL_AVX2]);
+
+    printf ("\n");
+    fflush (stdout);
+}
+
+int
+main (void)
+{
+    const SmolImplementation *impls [IMPL_MAX] = { NULL };
+    const SmolRepackMeta *meta;
+    char name [128];
+    int storage, filter, i;
+
+    impls [IMPL_GENERIC] = _smol_get_generic_implementation ();
+#ifdef SMOL_WITH_AVX2
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+        impls [IMPL_AVX2] = _smol_get_avx2_implementation ();
+#endif
+
+    printf ("%-52s %8s %8s %8s\n", "kernel (ns per pixel)",
+            impl_names [IMPL_GENERIC], impl_names [IMPL_AVX2], "speedup");
+
+    for (storage = SMOL_STORAGE_64BPP; storage <= SMOL_STORAGE_128BPP; storage++)
+    {
+        for (filter = 0; filter < SMOL_FILTER_MAX; filter++)
+        {
+            double ns [IMPL_MAX];
+
+            for (i = 0; i < IMPL_MAX; i++)
+                ns [i] = impls [i] ? time_hfilter (impls [i], storage, filter) : -1.0;
+
+            snprintf (name, sizeof (name), "hfilter %sbpp %s", storage_names [storage],
+                      filter_names [filter]);
+            print_row (name, ns);
+        }
+    }
+
+    for (storage = SMOL_STORAGE_64BPP; storage <= SMOL_STORAGE_128BPP; storage++)
+    {
+        for (filter = 0; filter < SMOL_FILTER_MAX; filter++)
+        {
+            double ns [IMPL_MAX];
+
+            for (i = 0; i < IMPL_MAX; i++)
+                ns [i] = impls [i] ? time_vfilter (impls [i], storage, filter) : -1.0;
+
+            snprintf (name, sizeof (name), "vfilter %sbpp %s", storage_names [storage],
+                      filter_names [filter]);
+            print_row (name, ns);
+        }
+    }
+
+    /* Repacks are matched across implementations by signature */
+    for (meta = impls [IMPL_GENERIC]->repack_meta; meta->repack_row_func; meta++)
+    {
+        double ns [IMPL_MAX];
+
+        for (i = 0; i < IMPL_MAX; i++)
+        {
+            const SmolRepackMeta *m;
+
+            ns [i] = -1.0;
+            if (!impls [i])
+                continue;
+
+            for (m = impls [i]->repack_meta; m->repack_row_func; m++)
+            {
+                if (m->signature == meta->signature)
+                {
+                    ns [i] = time_repack (impls [i], m);
+                    break;
+                }
+            }
+        }
+
+        snprintf (name, sizeof (name), "repack r%02u %s/%s/%s -> %s/%s/%s",
+                  SIG_REORDER (meta->signature),
+                  storage_names [SIG_STORAGE_IN (meta->signature)],
+                  alpha_names [SIG_ALPHA_IN (meta->signature)],
+                  gamma_names [SIG_GAMMA_IN (meta->signature)],
+                  storage_names [SIG_STORAGE_OUT (meta->signature)],
+                  alpha_names [SIG_ALPHA_OUT (meta->signature)],
+                  gamma_names [SIG_GAMMA_OUT (meta->signature)]);
+        print_row (name, ns);
+    }
+
+    return 0;
+}
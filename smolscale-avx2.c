@@ -221,6 +221,7 @@ init_horizontal (SmolScaleCtx *scale_ctx)
                                 scale_ctx->width_in,
                                 scale_ctx->width_bilin_out,
                                 TRUE, TRUE);
+        scale_ctx->precalc_x_is_absolute = TRUE;
     }
     else /* SMOL_FILTER_BILINEAR_?H */
     {
@@ -309,15 +310,29 @@ premul_u_to_p16_128bpp (uint64_t *inout,
     inout [1] = inout [1] * alpha;
 }
 
+/* Filter rounding can leave colors slightly above alpha. Those must saturate
+ * instead of wrapping around, matching the SIMD packers. */
+static SMOL_INLINE uint64_t
+saturate_u_128bpp (uint64_t in)
+{
+    uint64_t over = (in >> 8) & 0x000000ff000000ffULL;
+
+    over |= over >> 4;
+    over |= over >> 2;
+    over |= over >> 1;
+
+    return (in | ((over & 0x0000000100000001ULL) * 0xff)) & 0x000000ff000000ffULL;
+}
+
 static SMOL_INLINE void
 unpremul_p16_to_u_128bpp (const uint64_t * SMOL_RESTRICT in,
                           uint64_t * SMOL_RESTRICT out,
                           uint8_t alpha)
 {
-    out [0] = ((in [0] * _smol_inv_div_p16_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P16) & 0x000000ff000000ffULL;
-    out [1] = ((in [1] * _smol_inv_div_p16_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P16) & 0x000000ff000000ffULL;
+    out [0] = saturate_u_128bpp ((in [0] * _smol_inv_div_p16_lut [alpha])
+                                 >> INVERTED_DIV_SHIFT_P16);
+    out [1] = saturate_u_128bpp ((in [1] * _smol_inv_div_p16_lut [alpha])
+                                 >> INVERTED_DIV_SHIFT_P16);
 }
 
 /* --------- *
@@ -776,26 +791,40 @@ SMOL_REPACK_ROW_DEF (1234,  32, 32, UNASSOCIATED, COMPRESSED,
  * Repacking: 64 -> 24/32 *
  * ---------------------- */
 
-static void
+/* If stream is set, the output must be aligned and is written with
+ * non-temporal stores. The input then doesn't have to be aligned. */
+static SMOL_INLINE void
 pack_8x_1234_p8_to_xxxx_p8_64bpp (const uint64_t * SMOL_RESTRICT *in,
                                   uint32_t * SMOL_RESTRICT *out,
                                   uint32_t * out_max,
-                                  const __m256i channel_shuf)
+                                  const __m256i channel_shuf,
+                                  const SmolBool stream)
 {
     const __m256i * SMOL_RESTRICT my_in = (const __m256i * SMOL_RESTRICT) *in;
     __m256i * SMOL_RESTRICT my_out = (__m256i * SMOL_RESTRICT) *out;
     __m256i m0, m1;
 
-    SMOL_ASSUME_ALIGNED (my_in, __m256i * SMOL_RESTRICT);
+    if (!stream)
+        SMOL_ASSUME_ALIGNED (my_in, __m256i * SMOL_RESTRICT);
 
     while ((ptrdiff_t) (my_out + 1) <= (ptrdiff_t) out_max)
     {
         /* Load inputs */
 
-        m0 = _mm256_stream_load_si256 (my_in);
-        my_in++;
-        m1 = _mm256_stream_load_si256 (my_in);
-        my_in++;
+        if (stream)
+        {
+            m0 = _mm256_loadu_si256 (my_in);
+            my_in++;
+            m1 = _mm256_loadu_si256 (my_in);
+            my_in++;
+        }
+        else
+        {
+            m0 = _mm256_stream_load_si256 (my_in);
+            my_in++;
+            m1 = _mm256_stream_load_si256 (my_in);
+            my_in++;
+        }
 
         /* Pack and store */
 
@@ -803,7 +832,10 @@ pack_8x_1234_p8_to_xxxx_p8_64bpp (const uint64_t * SMOL_RESTRICT *in,
         m0 = _mm256_shuffle_epi8 (m0, channel_shuf);
         m0 = _mm256_permute4x64_epi64 (m0, SMOL_4X2BIT (3, 1, 2, 0));
 
-        _mm256_storeu_si256 (my_out, m0);
+        if (stream)
+            _mm256_stream_si256 (my_out, m0);
+        else
+            _mm256_storeu_si256 (my_out, m0);
         my_out++;
     }
 
@@ -921,11 +953,27 @@ SMOL_REPACK_ROW_DEF (1234, 64, 64, PREMUL8,       COMPRESSED,
                      1324, 32, 32, PREMUL8,       COMPRESSED) {
     const __m256i channel_shuf = PACK_SHUF_MM256_EPI8_32_TO_64 (1, 3, 2, 4);
     pack_8x_1234_p8_to_xxxx_p8_64bpp (&row_in, &row_out, row_out_max,
-                                      channel_shuf);
+                                      channel_shuf, FALSE);
+    while (row_out != row_out_max)
+    {
+        *(row_out++) = pack_pixel_1234_p8_to_1324_p8_64bpp (*(row_in++));
+    }
+} SMOL_REPACK_ROW_DEF_END
+
+SMOL_REPACK_STREAM_ROW_DEF (1234, 64, 64, PREMUL8,       COMPRESSED,
+                            1324, 32, 32, PREMUL8,       COMPRESSED) {
+    const __m256i channel_shuf = PACK_SHUF_MM256_EPI8_32_TO_64 (1, 3, 2, 4);
+    while (row_out != row_out_max && ((uintptr_t) row_out & 31))
+    {
+        *(row_out++) = pack_pixel_1234_p8_to_1324_p8_64bpp (*(row_in++));
+    }
+    pack_8x_1234_p8_to_xxxx_p8_64bpp (&row_in, &row_out, row_out_max,
+                                      channel_shuf, TRUE);
     while (row_out != row_out_max)
     {
         *(row_out++) = pack_pixel_1234_p8_to_1324_p8_64bpp (*(row_in++));
     }
+    _mm_sfence ();
 } SMOL_REPACK_ROW_DEF_END
 
 SMOL_REPACK_ROW_DEF (1234, 64, 64, PREMUL8,       COMPRESSED,
@@ -944,12 +992,29 @@ SMOL_REPACK_ROW_DEF (1234, 64, 64, PREMUL8,       COMPRESSED,
                          a##b##c##d, 32, 32, PREMUL8,       COMPRESSED) { \
         const __m256i channel_shuf = PACK_SHUF_MM256_EPI8_32_TO_64 ((a), (b), (c), (d)); \
         pack_8x_1234_p8_to_xxxx_p8_64bpp (&row_in, &row_out, row_out_max, \
-                                          channel_shuf); \
+                                          channel_shuf, FALSE); \
+        while (row_out != row_out_max) \
+        { \
+            *(row_out++) = PACK_FROM_1234_64BPP (*row_in, a, b, c, d); \
+            row_in++; \
+        } \
+    } SMOL_REPACK_ROW_DEF_END \
+    SMOL_REPACK_STREAM_ROW_DEF (1234,       64, 64, PREMUL8,       COMPRESSED, \
+                                a##b##c##d, 32, 32, PREMUL8,       COMPRESSED) { \
+        const __m256i channel_shuf = PACK_SHUF_MM256_EPI8_32_TO_64 ((a), (b), (c), (d)); \
+        while (row_out != row_out_max && ((uintptr_t) row_out & 31)) \
+        { \
+            *(row_out++) = PACK_FROM_1234_64BPP (*row_in, a, b, c, d); \
+            row_in++; \
+        } \
+        pack_8x_1234_p8_to_xxxx_p8_64bpp (&row_in, &row_out, row_out_max, \
+                                          channel_shuf, TRUE); \
         while (row_out != row_out_max) \
         { \
             *(row_out++) = PACK_FROM_1234_64BPP (*row_in, a, b, c, d); \
             row_in++; \
         } \
+        _mm_sfence (); \
     } SMOL_REPACK_ROW_DEF_END \
     SMOL_REPACK_ROW_DEF (1234,       64, 64, PREMUL8,       COMPRESSED, \
                          a##b##c##d, 32, 32, UNASSOCIATED,  COMPRESSED) { \
@@ -971,11 +1036,14 @@ DEF_REPACK_FROM_1234_64BPP_TO_32BPP (4, 2, 3, 1)
  * Repacking: 128 -> 24/32 *
  * ----------------------- */
 
-static void
+/* If stream is set, the output must be aligned and is written with
+ * non-temporal stores. The input then doesn't have to be aligned. */
+static SMOL_INLINE void
 pack_8x_123a_p16_to_xxxx_u_128bpp (const uint64_t * SMOL_RESTRICT *in,
                                    uint32_t * SMOL_RESTRICT *out,
                                    uint32_t * out_max,
-                                   const __m256i channel_shuf)
+                                   const __m256i channel_shuf,
+                                   const SmolBool stream)
 {
 #define ALPHA_MUL (1 << (INVERTED_DIV_SHIFT_P16 - 8))
 #define ALPHA_MASK SMOL_8X1BIT (0, 1, 0, 0, 0, 1, 0, 0)
@@ -990,20 +1058,35 @@ pack_8x_123a_p16_to_xxxx_u_128bpp (const uint64_t * SMOL_RESTRICT *in,
     __m256i * SMOL_RESTRICT my_out = (__m256i * SMOL_RESTRICT) *out;
     __m256i m0, m1, m2, m3, m4, m5, m6, m7, m8;
 
-    SMOL_ASSUME_ALIGNED (my_in, __m256i * SMOL_RESTRICT);
+    if (!stream)
+        SMOL_ASSUME_ALIGNED (my_in, __m256i * SMOL_RESTRICT);
 
     while ((ptrdiff_t) (my_out + 1) <= (ptrdiff_t) out_max)
     {
         /* Load inputs */
 
-        m0 = _mm256_stream_load_si256 (my_in);
-        my_in++;
-        m1 = _mm256_stream_load_si256 (my_in);
-        my_in++;
-        m2 = _mm256_stream_load_si256 (my_in);
-        my_in++;
-        m3 = _mm256_stream_load_si256 (my_in);
-        my_in++;
+        if (stream)
+        {
+            m0 = _mm256_loadu_si256 (my_in);
+            my_in++;
+            m1 = _mm256_loadu_si256 (my_in);
+            my_in++;
+            m2 = _mm256_loadu_si256 (my_in);
+            my_in++;
+            m3 = _mm256_loadu_si256 (my_in);
+            my_in++;
+        }
+        else
+        {
+            m0 = _mm256_stream_load_si256 (my_in);
+            my_in++;
+            m1 = _mm256_stream_load_si256 (my_in);
+            my_in++;
+            m2 = _mm256_stream_load_si256 (my_in);
+            my_in++;
+            m3 = _mm256_stream_load_si256 (my_in);
+            my_in++;
+        }
 
         /* Load alpha factors */
 
@@ -1050,7 +1133,10 @@ pack_8x_123a_p16_to_xxxx_u_128bpp (const uint64_t * SMOL_RESTRICT *in,
         m0 = _mm256_permute4x64_epi64 (m0, SMOL_4X2BIT (3, 1, 2, 0));
         m0 = _mm256_shuffle_epi32 (m0, SMOL_4X2BIT (3, 1, 2, 0));
 
-        _mm256_storeu_si256 (my_out, m0);
+        if (stream)
+            _mm256_stream_si256 (my_out, m0);
+        else
+            _mm256_storeu_si256 (my_out, m0);
         my_out += 1;
     }
 
@@ -1167,7 +1253,31 @@ SMOL_REPACK_ROW_DEF (1234, 128, 64, PREMUL16,      COMPRESSED,
                          a##b##c##d,  32, 32, UNASSOCIATED,  COMPRESSED) { \
         const __m256i channel_shuf = PACK_SHUF_MM256_EPI8_32_TO_128 ((a), (b), (c), (d)); \
         pack_8x_123a_p16_to_xxxx_u_128bpp (&row_in, &row_out, row_out_max, \
-                                           channel_shuf);               \
+                                           channel_shuf, FALSE);        \
+        while (row_out != row_out_max) \
+        { \
+            uint64_t t [2]; \
+            uint8_t alpha = row_in [1] >> 8; \
+            unpremul_p16_to_u_128bpp (row_in, t, alpha); \
+            t [1] = (t [1] & 0xffffffff00000000ULL) | alpha; \
+            *(row_out++) = PACK_FROM_1234_128BPP (t, a, b, c, d); \
+            row_in += 2; \
+        } \
+    } SMOL_REPACK_ROW_DEF_END \
+    SMOL_REPACK_STREAM_ROW_DEF (1234,       128, 64, PREMUL16,      COMPRESSED, \
+                                a##b##c##d,  32, 32, UNASSOCIATED,  COMPRESSED) { \
+        const __m256i channel_shuf = PACK_SHUF_MM256_EPI8_32_TO_128 ((a), (b), (c), (d)); \
+        while (row_out != row_out_max && ((uintptr_t) row_out & 31)) \
+        { \
+            uint64_t t [2]; \
+            uint8_t alpha = row_in [1] >> 8; \
+            unpremul_p16_to_u_128bpp (row_in, t, alpha); \
+            t [1] = (t [1] & 0xffffffff00000000ULL) | alpha; \
+            *(row_out++) = PACK_FROM_1234_128BPP (t, a, b, c, d); \
+            row_in += 2; \
+        } \
+        pack_8x_123a_p16_to_xxxx_u_128bpp (&row_in, &row_out, row_out_max, \
+                                           channel_shuf, TRUE);         \
         while (row_out != row_out_max) \
         { \
             uint64_t t [2]; \
@@ -1177,6 +1287,7 @@ SMOL_REPACK_ROW_DEF (1234, 128, 64, PREMUL16,      COMPRESSED,
             *(row_out++) = PACK_FROM_1234_128BPP (t, a, b, c, d); \
             row_in += 2; \
         } \
+        _mm_sfence (); \
     } SMOL_REPACK_ROW_DEF_END
 
 DEF_REPACK_FROM_1234_128BPP_TO_32BPP (1, 2, 3, 4)
@@ -1213,6 +1324,29 @@ inrow_ofs_to_pointer (const SmolScaleCtx *scale_ctx,
     return scale_ctx->pixels_in + scale_ctx->rowstride_in * inrow_ofs;
 }
 
+/* Issues prefetches for an inrow that will be needed soon, so it's on its
+ * way from memory while the current one is being filtered. Rows beyond
+ * the end of the image are ignored. */
+static SMOL_INLINE void
+prefetch_inrow (const SmolScaleCtx *scale_ctx,
+                uint32_t inrow_ofs)
+{
+    const char *p, *p_max;
+    uint32_t n_bytes;
+
+    if (SMOL_PREFETCH_ROW_BYTES == 0 || inrow_ofs >= scale_ctx->height_in)
+        return;
+
+    n_bytes = scale_ctx->width_in
+        * ((scale_ctx->pixel_type_in == SMOL_PIXEL_RGB8
+            || scale_ctx->pixel_type_in == SMOL_PIXEL_BGR8) ? 3 : 4);
+    n_bytes = MIN (n_bytes, SMOL_PREFETCH_ROW_BYTES);
+
+    p = inrow_ofs_to_pointer (scale_ctx, inrow_ofs);
+    for (p_max = p + n_bytes; p < p_max; p += SMOL_CACHE_LINE_BYTES)
+        __builtin_prefetch (p);
+}
+
 static SMOL_INLINE uint64_t
 weight_pixel_64bpp (uint64_t p,
                     uint16_t w)
@@ -1230,43 +1364,6 @@ weight_pixel_128bpp (uint64_t *p,
     out [1] = ((p [1] * w) >> 8) & 0x00ffffff00ffffffULL;
 }
 
-static SMOL_INLINE void
-sum_parts_64bpp (const uint64_t ** SMOL_RESTRICT parts_in,
-                 uint64_t * SMOL_RESTRICT accum,
-                 uint32_t n)
-{
-    const uint64_t *pp_end;
-    const uint64_t * SMOL_RESTRICT pp = *parts_in;
-
-    SMOL_ASSUME_ALIGNED_TO (pp, const uint64_t *, sizeof (uint64_t));
-
-    for (pp_end = pp + n; pp < pp_end; pp++)
-    {
-        *accum += *pp;
-    }
-
-    *parts_in = pp;
-}
-
-static SMOL_INLINE void
-sum_parts_128bpp (const uint64_t ** SMOL_RESTRICT parts_in,
-                  uint64_t * SMOL_RESTRICT accum,
-                  uint32_t n)
-{
-    const uint64_t *pp_end;
-    const uint64_t * SMOL_RESTRICT pp = *parts_in;
-
-    SMOL_ASSUME_ALIGNED_TO (pp, const uint64_t *, sizeof (uint64_t) * 2);
-
-    for (pp_end = pp + n * 2; pp < pp_end; )
-    {
-        accum [0] += *(pp++);
-        accum [1] += *(pp++);
-    }
-
-    *parts_in = pp;
-}
-
 static SMOL_INLINE uint64_t
 scale_64bpp (uint64_t accum,
              uint64_t multiplier)
@@ -1283,6 +1380,7 @@ scale_64bpp (uint64_t accum,
     return (a & 0x000000ff000000ffULL) | ((b & 0x000000ff000000ffULL) << 16);
 }
 
+/* Linear PREMUL16 parts have 19 significant bits, so keep the whole lane */
 static SMOL_INLINE uint64_t
 scale_128bpp_half (uint64_t accum,
                    uint64_t multiplier)
@@ -1295,17 +1393,146 @@ scale_128bpp_half (uint64_t accum,
     b = (accum & 0xffffffff00000000ULL) >> 32;
     b = (b * multiplier + SMOL_BOXES_MULTIPLIER / 2) / SMOL_BOXES_MULTIPLIER;
 
-    return (a & 0x000000000000ffffULL)
-           | ((b & 0x000000000000ffffULL) << 32);
+    return (a & 0x00000000ffffffffULL)
+           | ((b & 0x00000000ffffffffULL) << 32);
+}
+
+/* Box sums for spans of whole pixels. Each pixel is added as one or two
+ * 64-bit words, like the generic code does, but four words at a time. */
+
+static SMOL_INLINE uint64_t
+sum_pixels_64bpp (const uint64_t ** SMOL_RESTRICT parts_in,
+                  uint32_t n)
+{
+    const uint64_t * SMOL_RESTRICT pp = *parts_in;
+    const uint64_t *pp_end = pp + n;
+    __m256i m0 = _mm256_setzero_si256 ();
+    __m128i m1;
+    uint64_t accum;
+
+    while (pp + 4 <= pp_end)
+    {
+        m0 = _mm256_add_epi64 (m0, _mm256_loadu_si256 ((const __m256i *) pp));
+        pp += 4;
+    }
+
+    m1 = _mm_add_epi64 (_mm256_castsi256_si128 (m0), _mm256_extracti128_si256 (m0, 1));
+    m1 = _mm_add_epi64 (m1, _mm_unpackhi_epi64 (m1, m1));
+    accum = _mm_cvtsi128_si64 (m1);
+
+    while (pp < pp_end)
+        accum += *(pp++);
+
+    *parts_in = pp;
+    return accum;
 }
 
 static SMOL_INLINE void
-scale_and_store_128bpp (const uint64_t * SMOL_RESTRICT accum,
-                        uint64_t multiplier,
-                        uint64_t ** SMOL_RESTRICT row_parts_out)
+sum_pixels_128bpp (const uint64_t ** SMOL_RESTRICT parts_in,
+                   uint64_t * SMOL_RESTRICT accum,
+                   uint32_t n)
+{
+    const uint64_t * SMOL_RESTRICT pp = *parts_in;
+    const uint64_t *pp_end = pp + n * 2;
+    __m256i m0 = _mm256_setzero_si256 ();
+    __m128i m1;
+
+    while (pp + 4 <= pp_end)
+    {
+        m0 = _mm256_add_epi64 (m0, _mm256_loadu_si256 ((const __m256i *) pp));
+        pp += 4;
+    }
+
+    m1 = _mm_add_epi64 (_mm256_castsi256_si128 (m0), _mm256_extracti128_si256 (m0, 1));
+
+    if (pp < pp_end)
+    {
+        m1 = _mm_add_epi64 (m1, _mm_loadu_si128 ((const __m128i *) pp));
+        pp += 2;
+    }
+
+    _mm_storeu_si128 ((__m128i *) accum, m1);
+    *parts_in = pp;
+}
+
+/* Applies the box multiplier to a row of sums, with the same result as
+ * scale_64bpp(). Each 16-bit sum is multiplied by the high and low halves
+ * of the multiplier separately, so everything stays in 16-bit lanes:
+ *
+ * (v * m + 2^23) >> 24 == (v * m_hi + ((v * m_lo) >> 16) + 2^7) >> 8
+ *
+ * Only the low 8 bits of the result are kept, so lane overflow in the
+ * left-hand terms doesn't matter. accums and parts_out may be the same. */
+static void
+scale_parts_64bpp (const uint64_t *accums,
+                   uint64_t *parts_out,
+                   uint64_t multiplier,
+                   uint32_t n)
 {
-    *(*row_parts_out)++ = scale_128bpp_half (accum [0], multiplier);
-    *(*row_parts_out)++ = scale_128bpp_half (accum [1], multiplier);
+    const __m256i mul_hi = _mm256_set1_epi16 (multiplier >> 16);
+    const __m256i mul_lo = _mm256_set1_epi16 (multiplier & 0xffff);
+    const __m256i bias = _mm256_set1_epi16 (1 << 7);
+    uint64_t *parts_out_max = parts_out + n;
+
+    while (parts_out + 4 <= parts_out_max)
+    {
+        __m256i m0, m1;
+
+        m0 = _mm256_loadu_si256 ((const __m256i *) accums);
+        accums += 4;
+
+        m1 = _mm256_mulhi_epu16 (m0, mul_lo);
+        m0 = _mm256_mullo_epi16 (m0, mul_hi);
+        m0 = _mm256_add_epi16 (m0, m1);
+        m0 = _mm256_add_epi16 (m0, bias);
+        m0 = _mm256_srli_epi16 (m0, 8);
+
+        _mm256_storeu_si256 ((__m256i *) parts_out, m0);
+        parts_out += 4;
+    }
+
+    while (parts_out != parts_out_max)
+        *(parts_out++) = scale_64bpp (*(accums++), multiplier);
+}
+
+/* Like scale_128bpp_half() for a row of pixels. The 32-bit sums are widened
+ * to 64 bits for the multiplication, so the result is identical. */
+static void
+scale_parts_128bpp (const uint64_t *accums,
+                    uint64_t *parts_out,
+                    uint64_t multiplier,
+                    uint32_t n)
+{
+    const __m256i mul = _mm256_set1_epi64x (multiplier);
+    const __m256i bias = _mm256_set1_epi64x (SMOL_BOXES_MULTIPLIER / 2);
+    const __m256i mask = _mm256_set1_epi64x (0xffffffff);
+    uint64_t *parts_out_max = parts_out + n * 2;
+
+    while (parts_out + 4 <= parts_out_max)
+    {
+        __m256i m0, m1;
+
+        m0 = _mm256_loadu_si256 ((const __m256i *) accums);
+        accums += 4;
+
+        m1 = _mm256_mul_epu32 (_mm256_srli_epi64 (m0, 32), mul);
+        m0 = _mm256_mul_epu32 (m0, mul);
+
+        m0 = _mm256_srli_epi64 (_mm256_add_epi64 (m0, bias), 24);
+        m1 = _mm256_srli_epi64 (_mm256_add_epi64 (m1, bias), 24);
+        m0 = _mm256_and_si256 (m0, mask);
+        m1 = _mm256_and_si256 (m1, mask);
+        m0 = _mm256_or_si256 (m0, _mm256_slli_epi64 (m1, 32));
+
+        _mm256_storeu_si256 ((__m256i *) parts_out, m0);
+        parts_out += 4;
+    }
+
+    while (parts_out != parts_out_max)
+    {
+        *(parts_out++) = scale_128bpp_half (*(accums++), multiplier);
+        *(parts_out++) = scale_128bpp_half (*(accums++), multiplier);
+    }
 }
 
 static void
@@ -1918,8 +2145,9 @@ interp_horizontal_boxes_64bpp (const SmolScaleCtx *scale_ctx,
 {
     const uint64_t * SMOL_RESTRICT pp;
     const uint16_t *precalc_x = scale_ctx->precalc_x;
+    uint64_t *row_parts_out_ptr = row_parts_out;
     uint64_t *row_parts_out_max = row_parts_out + scale_ctx->width_out - 1;
-    uint64_t accum = 0;
+    uint64_t accum;
     uint64_t p, q, r, s;
     uint32_t n;
     uint64_t F;
@@ -1931,9 +2159,11 @@ interp_horizontal_boxes_64bpp (const SmolScaleCtx *scale_ctx,
     p = weight_pixel_64bpp (*(pp++), 256);
     n = *(precalc_x++);
 
-    while (row_parts_out != row_parts_out_max)
+    /* Sums are stored unscaled, then scaled in one pass at the end */
+
+    while (row_parts_out_ptr != row_parts_out_max)
     {
-        sum_parts_64bpp ((const uint64_t ** SMOL_RESTRICT) &pp, &accum, n);
+        accum = sum_pixels_64bpp ((const uint64_t ** SMOL_RESTRICT) &pp, n);
 
         F = *(precalc_x++);
         n = *(precalc_x++);
@@ -1948,13 +2178,12 @@ interp_horizontal_boxes_64bpp (const SmolScaleCtx *scale_ctx,
         /* (255 * r) - (F * r) */
         p = (((r << 8) - r - s) >> 8) & 0x00ff00ff00ff00ffULL;
 
-        *(row_parts_out++) = scale_64bpp (accum, scale_ctx->span_mul_x);
-        accum = 0;
+        *(row_parts_out_ptr++) = accum;
     }
 
     /* Final box optionally features the rightmost fractional pixel */
 
-    sum_parts_64bpp ((const uint64_t ** SMOL_RESTRICT) &pp, &accum, n);
+    accum = sum_pixels_64bpp ((const uint64_t ** SMOL_RESTRICT) &pp, n);
 
     q = 0;
     F = *(precalc_x);
@@ -1962,7 +2191,9 @@ interp_horizontal_boxes_64bpp (const SmolScaleCtx *scale_ctx,
         q = weight_pixel_64bpp (*(pp), F);
 
     accum += p + q;
-    *(row_parts_out++) = scale_64bpp (accum, scale_ctx->span_mul_x);
+    *(row_parts_out_ptr++) = accum;
+
+    scale_parts_64bpp (row_parts_out, row_parts_out, scale_ctx->span_mul_x, scale_ctx->width_out);
 }
 
 static void
@@ -1972,8 +2203,9 @@ interp_horizontal_boxes_128bpp (const SmolScaleCtx *scale_ctx,
 {
     const uint64_t * SMOL_RESTRICT pp;
     const uint16_t *precalc_x = scale_ctx->precalc_x;
+    uint64_t *row_parts_out_ptr = row_parts_out;
     uint64_t *row_parts_out_max = row_parts_out + (scale_ctx->width_out - /* 2 */ 1) * 2;
-    uint64_t accum [2] = { 0, 0 };
+    uint64_t accum [2];
     uint64_t p [2], q [2], r [2], s [2];
     uint32_t n;
     uint64_t F;
@@ -1989,9 +2221,11 @@ interp_horizontal_boxes_128bpp (const SmolScaleCtx *scale_ctx,
 
     n = *(precalc_x++);
 
-    while (row_parts_out != row_parts_out_max)
+    /* Sums are stored unscaled, then scaled in one pass at the end */
+
+    while (row_parts_out_ptr != row_parts_out_max)
     {
-        sum_parts_128bpp ((const uint64_t ** SMOL_RESTRICT) &pp, accum, n);
+        sum_pixels_128bpp ((const uint64_t ** SMOL_RESTRICT) &pp, accum, n);
 
         F = *(precalc_x++);
         n = *(precalc_x++);
@@ -2011,17 +2245,13 @@ interp_horizontal_boxes_128bpp (const SmolScaleCtx *scale_ctx,
         p [0] = (((r [0] << 8) - r [0] - s [0]) >> 8) & 0x00ffffff00ffffff;
         p [1] = (((r [1] << 8) - r [1] - s [1]) >> 8) & 0x00ffffff00ffffff;
 
-        scale_and_store_128bpp (accum,
-                                scale_ctx->span_mul_x,
-                                (uint64_t ** SMOL_RESTRICT) &row_parts_out);
-
-        accum [0] = 0;
-        accum [1] = 0;
+        *(row_parts_out_ptr++) = accum [0];
+        *(row_parts_out_ptr++) = accum [1];
     }
 
     /* Final box optionally features the rightmost fractional pixel */
 
-    sum_parts_128bpp ((const uint64_t ** SMOL_RESTRICT) &pp, accum, n);
+    sum_pixels_128bpp ((const uint64_t ** SMOL_RESTRICT) &pp, accum, n);
 
     q [0] = 0;
     q [1] = 0;
@@ -2037,9 +2267,10 @@ interp_horizontal_boxes_128bpp (const SmolScaleCtx *scale_ctx,
     accum [0] += p [0] + q [0];
     accum [1] += p [1] + q [1];
 
-    scale_and_store_128bpp (accum,
-                            scale_ctx->span_mul_x,
-                            (uint64_t ** SMOL_RESTRICT) &row_parts_out);
+    *(row_parts_out_ptr++) = accum [0];
+    *(row_parts_out_ptr++) = accum [1];
+
+    scale_parts_128bpp (row_parts_out, row_parts_out, scale_ctx->span_mul_x, scale_ctx->width_out);
 }
 
 static void
@@ -2097,15 +2328,16 @@ interp_horizontal_copy_128bpp (const SmolScaleCtx *scale_ctx,
     memcpy (row_parts_out, row_parts_in, scale_ctx->width_out * 2 * sizeof (uint64_t));
 }
 
-static void
-scale_horizontal (const SmolScaleCtx *scale_ctx,
-                  SmolVerticalCtx *vertical_ctx,
-                  const char *row_in,
-                  uint64_t *row_parts_out)
+/* Returns the unpacked row, positioned for the horizontal filter. It's only
+ * valid until the next call. */
+static const uint64_t *
+unpack_horizontal (const SmolScaleCtx *scale_ctx,
+                   SmolVerticalCtx *vertical_ctx,
+                   const char *row_in)
 {
     uint64_t * SMOL_RESTRICT unpacked_in;
 
-    unpacked_in = vertical_ctx->parts_row [3];
+    unpacked_in = vertical_ctx->parts_row [3] + scale_ctx->unpack_ofs;
 
     /* 32-bit unpackers need 32-bit alignment */
     if ((((uintptr_t) row_in) & 3)
@@ -2114,18 +2346,60 @@ scale_horizontal (const SmolScaleCtx *scale_ctx,
     {
         if (!vertical_ctx->in_aligned)
             vertical_ctx->in_aligned =
-                smol_alloc_aligned (scale_ctx->width_in * sizeof (uint32_t),
+                smol_alloc_aligned (&scale_ctx->allocator,
+                                    scale_ctx->width_in * sizeof (uint32_t),
                                     &vertical_ctx->in_aligned_storage);
         memcpy (vertical_ctx->in_aligned, row_in, scale_ctx->width_in * sizeof (uint32_t));
         row_in = (const char *) vertical_ctx->in_aligned;
     }
 
-    scale_ctx->unpack_row_func ((const uint32_t *) row_in,
-                                unpacked_in,
-                                scale_ctx->width_in);
-    scale_ctx->hfilter_func (scale_ctx,
-                             unpacked_in,
-                             row_parts_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_UNPACK,
+                     scale_ctx->unpack_row_func ((const uint32_t *) row_in,
+                                                 unpacked_in,
+                                                 scale_ctx->width_in));
+    return vertical_ctx->parts_row [3] + scale_ctx->hfilter_ofs;
+}
+
+static void
+scale_horizontal (const SmolScaleCtx *scale_ctx,
+                  SmolVerticalCtx *vertical_ctx,
+                  const char *row_in,
+                  uint64_t *row_parts_out)
+{
+    const uint64_t *unpacked_in;
+
+    unpacked_in = unpack_horizontal (scale_ctx, vertical_ctx, row_in);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_HFILTER,
+                     scale_ctx->hfilter_func (scale_ctx,
+                                              unpacked_in,
+                                              row_parts_out));
+}
+
+/* Scales a row horizontally and adds it to the accumulator. When the width
+ * is unchanged, the unpacked row is added directly instead of being copied
+ * to row_parts_temp first. */
+static void
+scale_horizontal_and_add (const SmolScaleCtx *scale_ctx,
+                          SmolVerticalCtx *vertical_ctx,
+                          const char *row_in,
+                          uint64_t *row_parts_temp,
+                          uint64_t *accum,
+                          uint32_t n_parts)
+{
+    const uint64_t *parts;
+
+    parts = unpack_horizontal (scale_ctx, vertical_ctx, row_in);
+
+    if (scale_ctx->filter_h != SMOL_FILTER_COPY)
+    {
+        SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_HFILTER,
+                         scale_ctx->hfilter_func (scale_ctx,
+                                                  parts,
+                                                  row_parts_temp));
+        parts = row_parts_temp;
+    }
+
+    add_parts (parts, accum, n_parts);
 }
 
 /* ---------------- *
@@ -2138,10 +2412,22 @@ update_vertical_ctx_bilinear (const SmolScaleCtx *scale_ctx,
                               uint32_t outrow_index)
 {
     uint32_t new_in_ofs = scale_ctx->precalc_y [outrow_index * 2];
+    uint32_t next_in_ofs;
 
     if (new_in_ofs == vertical_ctx->in_ofs)
         return;
 
+    /* Prefetch the rows the next change will need. When magnifying, that's
+     * further ahead than the next outrow, and will be the following inrow. */
+
+    next_in_ofs = new_in_ofs + 1;
+    if (outrow_index + 1 < scale_ctx->height_bilin_out)
+        next_in_ofs = MAX (next_in_ofs, scale_ctx->precalc_y [(outrow_index + 1) * 2]);
+
+    if (next_in_ofs > new_in_ofs + 1)
+        prefetch_inrow (scale_ctx, next_in_ofs);
+    prefetch_inrow (scale_ctx, next_in_ofs + 1);
+
     if (new_in_ofs == vertical_ctx->in_ofs + 1)
     {
         uint64_t *t = vertical_ctx->parts_row [0];
@@ -2453,13 +2739,48 @@ interp_vertical_bilinear_final_##n_halvings##h_128bpp (uint64_t F, \
                                                        uint64_t * SMOL_RESTRICT accum_inout, \
                                                        uint32_t width) \
 { \
+    const __m256i mask = _mm256_set1_epi32 (0x00ffffff); \
     uint64_t *accum_inout_last = accum_inout + width; \
+    __m256i F256; \
 \
     SMOL_ASSUME_ALIGNED (top_row_parts_in, const uint64_t *); \
     SMOL_ASSUME_ALIGNED (bottom_row_parts_in, const uint64_t *); \
     SMOL_ASSUME_ALIGNED (accum_inout, uint64_t *); \
 \
-    do \
+    F256 = _mm256_set1_epi32 ((uint32_t) F); \
+\
+    while (accum_inout + 8 <= accum_inout_last) \
+    { \
+        __m256i m0, m1, m2, m3, o0, o1; \
+\
+        m0 = _mm256_load_si256 ((const __m256i *) top_row_parts_in); \
+        top_row_parts_in += 4; \
+        m2 = _mm256_load_si256 ((const __m256i *) top_row_parts_in); \
+        top_row_parts_in += 4; \
+        m1 = _mm256_load_si256 ((const __m256i *) bottom_row_parts_in); \
+        bottom_row_parts_in += 4; \
+        m3 = _mm256_load_si256 ((const __m256i *) bottom_row_parts_in); \
+        bottom_row_parts_in += 4; \
+        o0 = _mm256_load_si256 ((const __m256i *) accum_inout); \
+        o1 = _mm256_load_si256 ((const __m256i *) (accum_inout + 4)); \
+\
+        m0 = LERP_SIMD256_EPI32_AND_MASK (m0, m1, F256, mask); \
+        m2 = LERP_SIMD256_EPI32_AND_MASK (m2, m3, F256, mask); \
+\
+        o0 = _mm256_add_epi32 (o0, m0); \
+        o1 = _mm256_add_epi32 (o1, m2); \
+        o0 = _mm256_srli_epi32 (o0, n_halvings); \
+        o1 = _mm256_srli_epi32 (o1, n_halvings); \
+        o0 = _mm256_and_si256 (o0, mask); \
+        o1 = _mm256_and_si256 (o1, mask); \
+\
+        _mm256_store_si256 ((__m256i *) accum_inout, o0); \
+        accum_inout += 4; \
+        _mm256_store_si256 ((__m256i *) accum_inout, o1); \
+        accum_inout += 4; \
+    } \
+\
+    while (accum_inout != accum_inout_last) \
     { \
         uint64_t p, q; \
 \
@@ -2471,7 +2792,6 @@ interp_vertical_bilinear_final_##n_halvings##h_128bpp (uint64_t F, \
 \
         *(accum_inout++) = p; \
     } \
-    while (accum_inout != accum_inout_last); \
 }
 
 #define DEF_SCALE_OUTROW_BILINEAR(n_halvings) \
@@ -2510,7 +2830,8 @@ scale_outrow_bilinear_##n_halvings##h_64bpp (const SmolScaleCtx *scale_ctx, \
                                                           vertical_ctx->parts_row [2], \
                                                           scale_ctx->width_out); \
 \
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out); \
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,                    \
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out)); \
 } \
 \
 static void \
@@ -2548,7 +2869,8 @@ scale_outrow_bilinear_##n_halvings##h_128bpp (const SmolScaleCtx *scale_ctx, \
                                                            vertical_ctx->parts_row [2], \
                                                            scale_ctx->width_out * 2); \
 \
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out); \
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,                    \
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out)); \
 }
 
 static void
@@ -2563,7 +2885,8 @@ scale_outrow_bilinear_0h_64bpp (const SmolScaleCtx *scale_ctx,
                                           vertical_ctx->parts_row [1],
                                           vertical_ctx->parts_row [2],
                                           scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2578,7 +2901,8 @@ scale_outrow_bilinear_0h_128bpp (const SmolScaleCtx *scale_ctx,
                                            vertical_ctx->parts_row [1],
                                            vertical_ctx->parts_row [2],
                                            scale_ctx->width_out * 2);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 DEF_INTERP_VERTICAL_BILINEAR_FINAL(1)
@@ -2604,7 +2928,8 @@ scale_outrow_bilinear_1h_64bpp (const SmolScaleCtx *scale_ctx,
                                              vertical_ctx->parts_row [1],
                                              vertical_ctx->parts_row [2],
                                              scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2628,7 +2953,8 @@ scale_outrow_bilinear_1h_128bpp (const SmolScaleCtx *scale_ctx,
                                               vertical_ctx->parts_row [1],
                                               vertical_ctx->parts_row [2],
                                               scale_ctx->width_out * 2);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 DEF_INTERP_VERTICAL_BILINEAR_FINAL(2)
@@ -2648,15 +2974,10 @@ finalize_vertical_64bpp (const uint64_t * SMOL_RESTRICT accums,
                          uint64_t * SMOL_RESTRICT parts_out,
                          uint32_t n)
 {
-    uint64_t *parts_out_max = parts_out + n;
-
     SMOL_ASSUME_ALIGNED (accums, const uint64_t *);
     SMOL_ASSUME_ALIGNED (parts_out, uint64_t *);
 
-    while (parts_out != parts_out_max)
-    {
-        *(parts_out++) = scale_64bpp (*(accums++), multiplier);
-    }
+    scale_parts_64bpp (accums, parts_out, multiplier, n);
 }
 
 static void
@@ -2721,6 +3042,7 @@ update_vertical_ctx_box_64bpp (const SmolScaleCtx *scale_ctx,
     }
     else
     {
+        prefetch_inrow (scale_ctx, ofs_y_max);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y),
@@ -2732,6 +3054,7 @@ update_vertical_ctx_box_64bpp (const SmolScaleCtx *scale_ctx,
      * that case. */
     if (w2 || ofs_y_max < scale_ctx->height_in)
     {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y_max),
@@ -2774,18 +3097,19 @@ scale_outrow_box_64bpp (const SmolScaleCtx *scale_ctx,
 
     ofs_y++;
 
-    /* Add up whole rows */
+    /* Add up whole rows. Each is reduced horizontally once and added to
+     * the accumulator. Box windows don't overlap, so only the shared edge
+     * row is carried over to the next outrow. */
 
     while (ofs_y < ofs_y_max)
     {
-        scale_horizontal (scale_ctx,
-                          vertical_ctx,
-                          inrow_ofs_to_pointer (scale_ctx, ofs_y),
-                          vertical_ctx->parts_row [0]);
-        add_parts (vertical_ctx->parts_row [0],
-                   vertical_ctx->parts_row [2],
-                   scale_ctx->width_out);
-
+        prefetch_inrow (scale_ctx, ofs_y + 1);
+        scale_horizontal_and_add (scale_ctx,
+                                  vertical_ctx,
+                                  inrow_ofs_to_pointer (scale_ctx, ofs_y),
+                                  vertical_ctx->parts_row [0],
+                                  vertical_ctx->parts_row [2],
+                                  scale_ctx->width_out);
         ofs_y++;
     }
 
@@ -2793,7 +3117,8 @@ scale_outrow_box_64bpp (const SmolScaleCtx *scale_ctx,
                              scale_ctx->span_mul_y,
                              vertical_ctx->parts_row [0],
                              scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2802,16 +3127,10 @@ finalize_vertical_128bpp (const uint64_t * SMOL_RESTRICT accums,
                           uint64_t * SMOL_RESTRICT parts_out,
                           uint32_t n)
 {
-    uint64_t *parts_out_max = parts_out + n * 2;
-
     SMOL_ASSUME_ALIGNED (accums, const uint64_t *);
     SMOL_ASSUME_ALIGNED (parts_out, uint64_t *);
 
-    while (parts_out != parts_out_max)
-    {
-        *(parts_out++) = scale_128bpp_half (*(accums++), multiplier);
-        *(parts_out++) = scale_128bpp_half (*(accums++), multiplier);
-    }
+    scale_parts_128bpp (accums, parts_out, multiplier, n);
 }
 
 static void
@@ -2819,15 +3138,79 @@ weight_row_128bpp (uint64_t *row,
                    uint16_t w,
                    uint32_t n)
 {
+    const __m256i mask = _mm256_set1_epi32 (0x00ffffff);
+    const __m256i w256 = _mm256_set1_epi32 (w);
     uint64_t *row_max = row + (n * 2);
 
     SMOL_ASSUME_ALIGNED (row, uint64_t *);
 
+    /* Channels are at most 24 bits, so the products fit in 32-bit lanes */
+
+    while (row + 8 <= row_max)
+    {
+        __m256i m0, m1;
+
+        m0 = _mm256_load_si256 ((const __m256i *) row);
+        m1 = _mm256_load_si256 ((const __m256i *) (row + 4));
+
+        m0 = _mm256_srli_epi32 (_mm256_mullo_epi32 (m0, w256), 8);
+        m1 = _mm256_srli_epi32 (_mm256_mullo_epi32 (m1, w256), 8);
+        m0 = _mm256_and_si256 (m0, mask);
+        m1 = _mm256_and_si256 (m1, mask);
+
+        _mm256_store_si256 ((__m256i *) row, m0);
+        _mm256_store_si256 ((__m256i *) (row + 4), m1);
+        row += 8;
+    }
+
+    while (row != row_max)
+    {
+        row [0] = ((row [0] * w) >> 8) & 0x00ffffff00ffffffULL;
+        row [1] = ((row [1] * w) >> 8) & 0x00ffffff00ffffffULL;
+        row += 2;
+    }
+}
+
+static void
+split_edge_row_128bpp (uint64_t * SMOL_RESTRICT row,
+                       uint64_t * SMOL_RESTRICT row_next,
+                       uint16_t w,
+                       uint16_t w_next,
+                       uint32_t n)
+{
+    const __m256i mask = _mm256_set1_epi32 (0x00ffffff);
+    const __m256i w256 = _mm256_set1_epi32 (w);
+    const __m256i w_next256 = _mm256_set1_epi32 (w_next);
+    uint64_t *row_max = row + (n * 2);
+
+    SMOL_ASSUME_ALIGNED (row, uint64_t *);
+    SMOL_ASSUME_ALIGNED (row_next, uint64_t *);
+
+    while (row + 4 <= row_max)
+    {
+        __m256i m0, m1;
+
+        m0 = _mm256_load_si256 ((const __m256i *) row);
+
+        m1 = _mm256_srli_epi32 (_mm256_mullo_epi32 (m0, w_next256), 8);
+        m0 = _mm256_srli_epi32 (_mm256_mullo_epi32 (m0, w256), 8);
+        m1 = _mm256_and_si256 (m1, mask);
+        m0 = _mm256_and_si256 (m0, mask);
+
+        _mm256_store_si256 ((__m256i *) row_next, m1);
+        _mm256_store_si256 ((__m256i *) row, m0);
+        row += 4;
+        row_next += 4;
+    }
+
     while (row != row_max)
     {
+        row_next [0] = ((row [0] * w_next) >> 8) & 0x00ffffff00ffffffULL;
+        row_next [1] = ((row [1] * w_next) >> 8) & 0x00ffffff00ffffffULL;
         row [0] = ((row [0] * w) >> 8) & 0x00ffffff00ffffffULL;
         row [1] = ((row [1] * w) >> 8) & 0x00ffffff00ffffffULL;
         row += 2;
+        row_next += 2;
     }
 }
 
@@ -2845,54 +3228,77 @@ scale_outrow_box_128bpp (const SmolScaleCtx *scale_ctx,
     ofs_y = scale_ctx->precalc_y [outrow_index * 2];
     ofs_y_max = scale_ctx->precalc_y [(outrow_index + 1) * 2];
 
-    /* Scale the first inrow and store it */
-
-    scale_horizontal (scale_ctx,
-                      vertical_ctx,
-                      inrow_ofs_to_pointer (scale_ctx, ofs_y),
-                      vertical_ctx->parts_row [0]);
-    weight_row_128bpp (vertical_ctx->parts_row [0],
-                       outrow_index == 0 ? 256 : 255 - scale_ctx->precalc_y [outrow_index * 2 - 1],
-                       scale_ctx->width_out);
-    ofs_y++;
-
-    /* Add up whole rows */
+    /* Scale the first inrow and store it. If it was the previous outrow's
+     * final row, its weighted contribution is already in parts_row [2]. */
 
-    while (ofs_y < ofs_y_max)
+    if (ofs_y == vertical_ctx->in_ofs)
+    {
+        uint64_t *t = vertical_ctx->parts_row [0];
+        vertical_ctx->parts_row [0] = vertical_ctx->parts_row [2];
+        vertical_ctx->parts_row [2] = t;
+    }
+    else
     {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y),
-                          vertical_ctx->parts_row [1]);
-        add_parts (vertical_ctx->parts_row [1],
-                   vertical_ctx->parts_row [0],
-                   scale_ctx->width_out * 2);
+                          vertical_ctx->parts_row [0]);
+        weight_row_128bpp (vertical_ctx->parts_row [0],
+                           outrow_index == 0 ? 256 : 255 - scale_ctx->precalc_y [outrow_index * 2 - 1],
+                           scale_ctx->width_out);
+    }
+
+    ofs_y++;
+
+    /* Add up whole rows. Each is reduced horizontally once and added to
+     * the accumulator. Box windows don't overlap, so only the shared edge
+     * row is carried over to the next outrow. */
 
+    while (ofs_y < ofs_y_max)
+    {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
+        scale_horizontal_and_add (scale_ctx,
+                                  vertical_ctx,
+                                  inrow_ofs_to_pointer (scale_ctx, ofs_y),
+                                  vertical_ctx->parts_row [1],
+                                  vertical_ctx->parts_row [0],
+                                  scale_ctx->width_out * 2);
         ofs_y++;
     }
 
-    /* Final row is optional; if this is the bottommost outrow it could be out of bounds */
+    /* Final row is optional; if this is the bottommost outrow it could be out of bounds.
+     * It's shared with the next outrow, so split it once and keep that part. */
 
     w = scale_ctx->precalc_y [outrow_index * 2 + 1];
     if (w > 0)
     {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y),
                           vertical_ctx->parts_row [1]);
-        weight_row_128bpp (vertical_ctx->parts_row [1],
-                           w - 1,  /* Subtract 1 to avoid overflow */
-                           scale_ctx->width_out);
+        split_edge_row_128bpp (vertical_ctx->parts_row [1],
+                               vertical_ctx->parts_row [2],
+                               w - 1,  /* Subtract 1 to avoid overflow */
+                               255 - w,
+                               scale_ctx->width_out);
         add_parts (vertical_ctx->parts_row [1],
                    vertical_ctx->parts_row [0],
                    scale_ctx->width_out * 2);
+        vertical_ctx->in_ofs = ofs_y;
+    }
+    else
+    {
+        vertical_ctx->in_ofs = UINT_MAX - 1;
     }
 
     finalize_vertical_128bpp (vertical_ctx->parts_row [0],
                               scale_ctx->span_mul_y,
                               vertical_ctx->parts_row [1],
                               scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [1], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [1], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2914,7 +3320,8 @@ scale_outrow_one_64bpp (const SmolScaleCtx *scale_ctx,
         vertical_ctx->in_ofs = 0;
     }
 
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2936,7 +3343,8 @@ scale_outrow_one_128bpp (const SmolScaleCtx *scale_ctx,
         vertical_ctx->in_ofs = 0;
     }
 
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2945,12 +3353,14 @@ scale_outrow_copy (const SmolScaleCtx *scale_ctx,
                    uint32_t row_index,
                    uint32_t *row_out)
 {
+    prefetch_inrow (scale_ctx, row_index + 1);
     scale_horizontal (scale_ctx,
                       vertical_ctx,
                       inrow_ofs_to_pointer (scale_ctx, row_index),
                       vertical_ctx->parts_row [0]);
 
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 /* --------------- *
@@ -3024,8 +3434,31 @@ static const SmolRepackMeta repack_meta [] =
 
 #undef R
 
+#define R SMOL_REPACK_STREAM_META
+
+static const SmolRepackMeta repack_stream_meta [] =
+{
+    R (1234,  64, PREMUL8,      COMPRESSED, 1324,  32, PREMUL8,       COMPRESSED),
+    R (1234,  64, PREMUL8,      COMPRESSED, 1423,  32, PREMUL8,       COMPRESSED),
+    R (1234,  64, PREMUL8,      COMPRESSED, 2314,  32, PREMUL8,       COMPRESSED),
+    R (1234,  64, PREMUL8,      COMPRESSED, 4132,  32, PREMUL8,       COMPRESSED),
+    R (1234,  64, PREMUL8,      COMPRESSED, 4231,  32, PREMUL8,       COMPRESSED),
+
+    R (1234, 128, PREMUL16,     COMPRESSED, 1234,  32, UNASSOCIATED,  COMPRESSED),
+    R (1234, 128, PREMUL16,     COMPRESSED, 3214,  32, UNASSOCIATED,  COMPRESSED),
+    R (1234, 128, PREMUL16,     COMPRESSED, 4123,  32, UNASSOCIATED,  COMPRESSED),
+    R (1234, 128, PREMUL16,     COMPRESSED, 4321,  32, UNASSOCIATED,  COMPRESSED),
+
+    SMOL_REPACK_META_LAST
+};
+
+#undef R
+
 static const SmolImplementation implementation =
 {
+    /* Name */
+    "avx2",
+
     /* Horizontal init */
     init_horizontal,
 
@@ -3102,7 +3535,8 @@ static const SmolImplementation implementation =
             scale_outrow_box_128bpp
         }
     },
-    repack_meta
+    repack_meta,
+    repack_stream_meta
 };
 
 const SmolImplementation *
@@ -214,6 +214,32 @@ to_srgb_pixel_xxxa_128bpp (const uint64_t *pixel_in, uint64_t *pixel_out)
  * Premultiplication *
  * ----------------- */
 
+/* Filter rounding can leave colors slightly above alpha. Those must saturate
+ * instead of wrapping around, matching the SIMD packers. */
+static SMOL_INLINE uint64_t
+saturate_u_128bpp (uint64_t in)
+{
+    uint64_t over = (in >> 8) & 0x000000ff000000ffULL;
+
+    over |= over >> 4;
+    over |= over >> 2;
+    over |= over >> 1;
+
+    return (in | ((over & 0x0000000100000001ULL) * 0xff)) & 0x000000ff000000ffULL;
+}
+
+/* Linear variant. Bits above 12 hold spill from the other lane's product
+ * and are masked off. */
+static SMOL_INLINE uint64_t
+saturate_ul_128bpp (uint64_t in)
+{
+    uint64_t over = (in >> 11) & 0x0000000300000003ULL;
+
+    over |= over >> 1;
+
+    return (in | ((over & 0x0000000100000001ULL) * 0x7ff)) & 0x000007ff000007ffULL;
+}
+
 static SMOL_INLINE void
 premul_u_to_p8_128bpp (uint64_t * SMOL_RESTRICT inout,
                        uint8_t alpha)
@@ -273,10 +299,10 @@ unpremul_p8l_to_ul_128bpp (const uint64_t *in,
                            uint64_t *out,
                            uint8_t alpha)
 {
-    out [0] = ((in [0] * _smol_inv_div_p8l_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P8L) & 0x000007ff000007ff;
-    out [1] = ((in [1] * _smol_inv_div_p8l_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P8L) & 0x000007ff000007ff;
+    out [0] = saturate_ul_128bpp ((in [0] * _smol_inv_div_p8l_lut [alpha])
+                                  >> INVERTED_DIV_SHIFT_P8L);
+    out [1] = saturate_ul_128bpp ((in [1] * _smol_inv_div_p8l_lut [alpha])
+                                  >> INVERTED_DIV_SHIFT_P8L);
 }
 
 static SMOL_INLINE void
@@ -292,10 +318,10 @@ unpremul_p16_to_u_128bpp (const uint64_t * SMOL_RESTRICT in,
                           uint64_t * SMOL_RESTRICT out,
                           uint8_t alpha)
 {
-    out [0] = ((in [0] * _smol_inv_div_p16_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P16) & 0x000000ff000000ffULL;
-    out [1] = ((in [1] * _smol_inv_div_p16_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P16) & 0x000000ff000000ffULL;
+    out [0] = saturate_u_128bpp ((in [0] * _smol_inv_div_p16_lut [alpha])
+                                 >> INVERTED_DIV_SHIFT_P16);
+    out [1] = saturate_u_128bpp ((in [1] * _smol_inv_div_p16_lut [alpha])
+                                 >> INVERTED_DIV_SHIFT_P16);
 }
 
 static SMOL_INLINE void
@@ -311,10 +337,10 @@ unpremul_p16l_to_ul_128bpp (const uint64_t * SMOL_RESTRICT in,
                             uint64_t * SMOL_RESTRICT out,
                             uint8_t alpha)
 {
-    out [0] = ((in [0] * _smol_inv_div_p16l_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P16L) & 0x000007ff000007ffULL;
-    out [1] = ((in [1] * _smol_inv_div_p16l_lut [alpha])
-               >> INVERTED_DIV_SHIFT_P16L) & 0x000007ff000007ffULL;
+    out [0] = saturate_ul_128bpp ((in [0] * _smol_inv_div_p16l_lut [alpha])
+                                  >> INVERTED_DIV_SHIFT_P16L);
+    out [1] = saturate_ul_128bpp ((in [1] * _smol_inv_div_p16l_lut [alpha])
+                                  >> INVERTED_DIV_SHIFT_P16L);
 }
 
 /* --------- *
@@ -1174,6 +1200,29 @@ inrow_ofs_to_pointer (const SmolScaleCtx *scale_ctx,
     return scale_ctx->pixels_in + scale_ctx->rowstride_in * inrow_ofs;
 }
 
+/* Issues prefetches for an inrow that will be needed soon, so it's on its
+ * way from memory while the current one is being filtered. Rows beyond
+ * the end of the image are ignored. */
+static SMOL_INLINE void
+prefetch_inrow (const SmolScaleCtx *scale_ctx,
+                uint32_t inrow_ofs)
+{
+    const char *p, *p_max;
+    uint32_t n_bytes;
+
+    if (SMOL_PREFETCH_ROW_BYTES == 0 || inrow_ofs >= scale_ctx->height_in)
+        return;
+
+    n_bytes = scale_ctx->width_in
+        * ((scale_ctx->pixel_type_in == SMOL_PIXEL_RGB8
+            || scale_ctx->pixel_type_in == SMOL_PIXEL_BGR8) ? 3 : 4);
+    n_bytes = MIN (n_bytes, SMOL_PREFETCH_ROW_BYTES);
+
+    p = inrow_ofs_to_pointer (scale_ctx, inrow_ofs);
+    for (p_max = p + n_bytes; p < p_max; p += SMOL_CACHE_LINE_BYTES)
+        __builtin_prefetch (p);
+}
+
 static SMOL_INLINE uint64_t
 weight_pixel_64bpp (uint64_t p,
                     uint16_t w)
@@ -1244,6 +1293,7 @@ scale_64bpp (uint64_t accum,
     return (a & 0x000000ff000000ffULL) | ((b & 0x000000ff000000ffULL) << 16);
 }
 
+/* Linear PREMUL16 parts have 19 significant bits, so keep the whole lane */
 static SMOL_INLINE uint64_t
 scale_128bpp_half (uint64_t accum,
                    uint64_t multiplier)
@@ -1256,8 +1306,8 @@ scale_128bpp_half (uint64_t accum,
     b = (accum & 0xffffffff00000000ULL) >> 32;
     b = (b * multiplier + SMOL_BOXES_MULTIPLIER / 2) / SMOL_BOXES_MULTIPLIER;
 
-    return (a & 0x000000000000ffffULL)
-           | ((b & 0x000000000000ffffULL) << 32);
+    return (a & 0x00000000ffffffffULL)
+           | ((b & 0x00000000ffffffffULL) << 32);
 }
 
 static SMOL_INLINE void
@@ -1610,15 +1660,16 @@ interp_horizontal_copy_128bpp (const SmolScaleCtx *scale_ctx,
     memcpy (row_parts_out, row_parts_in, scale_ctx->width_out * 2 * sizeof (uint64_t));
 }
 
-static void
-scale_horizontal (const SmolScaleCtx *scale_ctx,
-                  SmolVerticalCtx *vertical_ctx,
-                  const char *row_in,
-                  uint64_t *row_parts_out)
+/* Returns the unpacked row, positioned for the horizontal filter. It's only
+ * valid until the next call. */
+static const uint64_t *
+unpack_horizontal (const SmolScaleCtx *scale_ctx,
+                   SmolVerticalCtx *vertical_ctx,
+                   const char *row_in)
 {
     uint64_t * SMOL_RESTRICT unpacked_in;
 
-    unpacked_in = vertical_ctx->parts_row [3];
+    unpacked_in = vertical_ctx->parts_row [3] + scale_ctx->unpack_ofs;
 
     /* 32-bit unpackers need 32-bit alignment */
     if ((((uintptr_t) row_in) & 3)
@@ -1627,18 +1678,60 @@ scale_horizontal (const SmolScaleCtx *scale_ctx,
     {
         if (!vertical_ctx->in_aligned)
             vertical_ctx->in_aligned =
-                smol_alloc_aligned (scale_ctx->width_in * sizeof (uint32_t),
+                smol_alloc_aligned (&scale_ctx->allocator,
+                                    scale_ctx->width_in * sizeof (uint32_t),
                                     &vertical_ctx->in_aligned_storage);
         memcpy (vertical_ctx->in_aligned, row_in, scale_ctx->width_in * sizeof (uint32_t));
         row_in = (const char *) vertical_ctx->in_aligned;
     }
 
-    scale_ctx->unpack_row_func ((const uint32_t *) row_in,
-                                unpacked_in,
-                                scale_ctx->width_in);
-    scale_ctx->hfilter_func (scale_ctx,
-                             unpacked_in,
-                             row_parts_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_UNPACK,
+                     scale_ctx->unpack_row_func ((const uint32_t *) row_in,
+                                                 unpacked_in,
+                                                 scale_ctx->width_in));
+    return vertical_ctx->parts_row [3] + scale_ctx->hfilter_ofs;
+}
+
+static void
+scale_horizontal (const SmolScaleCtx *scale_ctx,
+                  SmolVerticalCtx *vertical_ctx,
+                  const char *row_in,
+                  uint64_t *row_parts_out)
+{
+    const uint64_t *unpacked_in;
+
+    unpacked_in = unpack_horizontal (scale_ctx, vertical_ctx, row_in);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_HFILTER,
+                     scale_ctx->hfilter_func (scale_ctx,
+                                              unpacked_in,
+                                              row_parts_out));
+}
+
+/* Scales a row horizontally and adds it to the accumulator. When the width
+ * is unchanged, the unpacked row is added directly instead of being copied
+ * to row_parts_temp first. */
+static void
+scale_horizontal_and_add (const SmolScaleCtx *scale_ctx,
+                          SmolVerticalCtx *vertical_ctx,
+                          const char *row_in,
+                          uint64_t *row_parts_temp,
+                          uint64_t *accum,
+                          uint32_t n_parts)
+{
+    const uint64_t *parts;
+
+    parts = unpack_horizontal (scale_ctx, vertical_ctx, row_in);
+
+    if (scale_ctx->filter_h != SMOL_FILTER_COPY)
+    {
+        SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_HFILTER,
+                         scale_ctx->hfilter_func (scale_ctx,
+                                                  parts,
+                                                  row_parts_temp));
+        parts = row_parts_temp;
+    }
+
+    add_parts (parts, accum, n_parts);
 }
 
 /* ---------------- *
@@ -1651,10 +1744,22 @@ update_vertical_ctx_bilinear (const SmolScaleCtx *scale_ctx,
                               uint32_t outrow_index)
 {
     uint32_t new_in_ofs = scale_ctx->precalc_y [outrow_index * 2];
+    uint32_t next_in_ofs;
 
     if (new_in_ofs == vertical_ctx->in_ofs)
         return;
 
+    /* Prefetch the rows the next change will need. When magnifying, that's
+     * further ahead than the next outrow, and will be the following inrow. */
+
+    next_in_ofs = new_in_ofs + 1;
+    if (outrow_index + 1 < scale_ctx->height_bilin_out)
+        next_in_ofs = MAX (next_in_ofs, scale_ctx->precalc_y [(outrow_index + 1) * 2]);
+
+    if (next_in_ofs > new_in_ofs + 1)
+        prefetch_inrow (scale_ctx, next_in_ofs);
+    prefetch_inrow (scale_ctx, next_in_ofs + 1);
+
     if (new_in_ofs == vertical_ctx->in_ofs + 1)
     {
         uint64_t *t = vertical_ctx->parts_row [0];
@@ -1874,7 +1979,8 @@ scale_outrow_bilinear_##n_halvings##h_64bpp (const SmolScaleCtx *scale_ctx, \
                                                           vertical_ctx->parts_row [2], \
                                                           scale_ctx->width_out); \
 \
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out); \
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,                    \
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out)); \
 } \
 \
 static void \
@@ -1912,7 +2018,8 @@ scale_outrow_bilinear_##n_halvings##h_128bpp (const SmolScaleCtx *scale_ctx, \
                                                            vertical_ctx->parts_row [2], \
                                                            scale_ctx->width_out * 2); \
 \
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out); \
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,                    \
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out)); \
 }
 
 static void
@@ -1927,7 +2034,8 @@ scale_outrow_bilinear_0h_64bpp (const SmolScaleCtx *scale_ctx,
                                           vertical_ctx->parts_row [1],
                                           vertical_ctx->parts_row [2],
                                           scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -1942,7 +2050,8 @@ scale_outrow_bilinear_0h_128bpp (const SmolScaleCtx *scale_ctx,
                                            vertical_ctx->parts_row [1],
                                            vertical_ctx->parts_row [2],
                                            scale_ctx->width_out * 2);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 DEF_INTERP_VERTICAL_BILINEAR_FINAL(1)
@@ -1968,7 +2077,8 @@ scale_outrow_bilinear_1h_64bpp (const SmolScaleCtx *scale_ctx,
                                              vertical_ctx->parts_row [1],
                                              vertical_ctx->parts_row [2],
                                              scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -1992,7 +2102,8 @@ scale_outrow_bilinear_1h_128bpp (const SmolScaleCtx *scale_ctx,
                                               vertical_ctx->parts_row [1],
                                               vertical_ctx->parts_row [2],
                                               scale_ctx->width_out * 2);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [2], row_out, scale_ctx->width_out));
 }
 
 DEF_INTERP_VERTICAL_BILINEAR_FINAL(2)
@@ -2085,6 +2196,7 @@ update_vertical_ctx_box_64bpp (const SmolScaleCtx *scale_ctx,
     }
     else
     {
+        prefetch_inrow (scale_ctx, ofs_y_max);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y),
@@ -2096,6 +2208,7 @@ update_vertical_ctx_box_64bpp (const SmolScaleCtx *scale_ctx,
      * that case. */
     if (w2 || ofs_y_max < scale_ctx->height_in)
     {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y_max),
@@ -2138,18 +2251,19 @@ scale_outrow_box_64bpp (const SmolScaleCtx *scale_ctx,
 
     ofs_y++;
 
-    /* Add up whole rows */
+    /* Add up whole rows. Each is reduced horizontally once and added to
+     * the accumulator. Box windows don't overlap, so only the shared edge
+     * row is carried over to the next outrow. */
 
     while (ofs_y < ofs_y_max)
     {
-        scale_horizontal (scale_ctx,
-                          vertical_ctx,
-                          inrow_ofs_to_pointer (scale_ctx, ofs_y),
-                          vertical_ctx->parts_row [0]);
-        add_parts (vertical_ctx->parts_row [0],
-                   vertical_ctx->parts_row [2],
-                   scale_ctx->width_out);
-
+        prefetch_inrow (scale_ctx, ofs_y + 1);
+        scale_horizontal_and_add (scale_ctx,
+                                  vertical_ctx,
+                                  inrow_ofs_to_pointer (scale_ctx, ofs_y),
+                                  vertical_ctx->parts_row [0],
+                                  vertical_ctx->parts_row [2],
+                                  scale_ctx->width_out);
         ofs_y++;
     }
 
@@ -2157,7 +2271,8 @@ scale_outrow_box_64bpp (const SmolScaleCtx *scale_ctx,
                              scale_ctx->span_mul_y,
                              vertical_ctx->parts_row [0],
                              scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2195,6 +2310,29 @@ weight_row_128bpp (uint64_t *row,
     }
 }
 
+static void
+split_edge_row_128bpp (uint64_t * SMOL_RESTRICT row,
+                       uint64_t * SMOL_RESTRICT row_next,
+                       uint16_t w,
+                       uint16_t w_next,
+                       uint32_t n)
+{
+    uint64_t *row_max = row + (n * 2);
+
+    SMOL_ASSUME_ALIGNED (row, uint64_t *);
+    SMOL_ASSUME_ALIGNED (row_next, uint64_t *);
+
+    while (row != row_max)
+    {
+        row_next [0] = ((row [0] * w_next) >> 8) & 0x00ffffff00ffffffULL;
+        row_next [1] = ((row [1] * w_next) >> 8) & 0x00ffffff00ffffffULL;
+        row [0] = ((row [0] * w) >> 8) & 0x00ffffff00ffffffULL;
+        row [1] = ((row [1] * w) >> 8) & 0x00ffffff00ffffffULL;
+        row += 2;
+        row_next += 2;
+    }
+}
+
 static void
 scale_outrow_box_128bpp (const SmolScaleCtx *scale_ctx,
                          SmolVerticalCtx *vertical_ctx,
@@ -2209,54 +2347,77 @@ scale_outrow_box_128bpp (const SmolScaleCtx *scale_ctx,
     ofs_y = scale_ctx->precalc_y [outrow_index * 2];
     ofs_y_max = scale_ctx->precalc_y [(outrow_index + 1) * 2];
 
-    /* Scale the first inrow and store it */
-
-    scale_horizontal (scale_ctx,
-                      vertical_ctx,
-                      inrow_ofs_to_pointer (scale_ctx, ofs_y),
-                      vertical_ctx->parts_row [0]);
-    weight_row_128bpp (vertical_ctx->parts_row [0],
-                       outrow_index == 0 ? 256 : 255 - scale_ctx->precalc_y [outrow_index * 2 - 1],
-                       scale_ctx->width_out);
-    ofs_y++;
-
-    /* Add up whole rows */
+    /* Scale the first inrow and store it. If it was the previous outrow's
+     * final row, its weighted contribution is already in parts_row [2]. */
 
-    while (ofs_y < ofs_y_max)
+    if (ofs_y == vertical_ctx->in_ofs)
+    {
+        uint64_t *t = vertical_ctx->parts_row [0];
+        vertical_ctx->parts_row [0] = vertical_ctx->parts_row [2];
+        vertical_ctx->parts_row [2] = t;
+    }
+    else
     {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y),
-                          vertical_ctx->parts_row [1]);
-        add_parts (vertical_ctx->parts_row [1],
-                   vertical_ctx->parts_row [0],
-                   scale_ctx->width_out * 2);
+                          vertical_ctx->parts_row [0]);
+        weight_row_128bpp (vertical_ctx->parts_row [0],
+                           outrow_index == 0 ? 256 : 255 - scale_ctx->precalc_y [outrow_index * 2 - 1],
+                           scale_ctx->width_out);
+    }
+
+    ofs_y++;
+
+    /* Add up whole rows. Each is reduced horizontally once and added to
+     * the accumulator. Box windows don't overlap, so only the shared edge
+     * row is carried over to the next outrow. */
 
+    while (ofs_y < ofs_y_max)
+    {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
+        scale_horizontal_and_add (scale_ctx,
+                                  vertical_ctx,
+                                  inrow_ofs_to_pointer (scale_ctx, ofs_y),
+                                  vertical_ctx->parts_row [1],
+                                  vertical_ctx->parts_row [0],
+                                  scale_ctx->width_out * 2);
         ofs_y++;
     }
 
-    /* Final row is optional; if this is the bottommost outrow it could be out of bounds */
+    /* Final row is optional; if this is the bottommost outrow it could be out of bounds.
+     * It's shared with the next outrow, so split it once and keep that part. */
 
     w = scale_ctx->precalc_y [outrow_index * 2 + 1];
     if (w > 0)
     {
+        prefetch_inrow (scale_ctx, ofs_y + 1);
         scale_horizontal (scale_ctx,
                           vertical_ctx,
                           inrow_ofs_to_pointer (scale_ctx, ofs_y),
                           vertical_ctx->parts_row [1]);
-        weight_row_128bpp (vertical_ctx->parts_row [1],
-                           w - 1,  /* Subtract 1 to avoid overflow */
-                           scale_ctx->width_out);
+        split_edge_row_128bpp (vertical_ctx->parts_row [1],
+                               vertical_ctx->parts_row [2],
+                               w - 1,  /* Subtract 1 to avoid overflow */
+                               255 - w,
+                               scale_ctx->width_out);
         add_parts (vertical_ctx->parts_row [1],
                    vertical_ctx->parts_row [0],
                    scale_ctx->width_out * 2);
+        vertical_ctx->in_ofs = ofs_y;
+    }
+    else
+    {
+        vertical_ctx->in_ofs = UINT_MAX - 1;
     }
 
     finalize_vertical_128bpp (vertical_ctx->parts_row [0],
                               scale_ctx->span_mul_y,
                               vertical_ctx->parts_row [1],
                               scale_ctx->width_out);
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [1], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [1], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2278,7 +2439,8 @@ scale_outrow_one_64bpp (const SmolScaleCtx *scale_ctx,
         vertical_ctx->in_ofs = 0;
     }
 
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2300,7 +2462,8 @@ scale_outrow_one_128bpp (const SmolScaleCtx *scale_ctx,
         vertical_ctx->in_ofs = 0;
     }
 
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 static void
@@ -2309,12 +2472,14 @@ scale_outrow_copy (const SmolScaleCtx *scale_ctx,
                    uint32_t row_index,
                    uint32_t *row_out)
 {
+    prefetch_inrow (scale_ctx, row_index + 1);
     scale_horizontal (scale_ctx,
                       vertical_ctx,
                       inrow_ofs_to_pointer (scale_ctx, row_index),
                       vertical_ctx->parts_row [0]);
 
-    scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out);
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [0], row_out, scale_ctx->width_out));
 }
 
 /* --------------- *
@@ -2416,6 +2581,9 @@ static const SmolRepackMeta repack_meta [] =
 
 static const SmolImplementation implementation =
 {
+    /* Name */
+    "generic",
+
     /* Horizontal init */
     init_horizontal,
 
@@ -2492,7 +2660,8 @@ static const SmolImplementation implementation =
             scale_outrow_box_128bpp
         }
     },
-    repack_meta
+    repack_meta,
+    NULL
 };
 
 const SmolImplementation *
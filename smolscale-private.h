@@ -19,14 +19,6 @@
 extern "C" {
 #endif
 
-#ifdef SMOL_USE_ALLOCA
-# define _SMOL_ALLOC(n) alloca (n)
-# define _SMOL_FREE(p)
-#else
-# define _SMOL_ALLOC(n) malloc (n)
-# define _SMOL_FREE(p) free (p)
-#endif
-
 /* Enum switches must handle every value */
 #ifdef __GNUC__
 # pragma GCC diagnostic error "-Wswitch"
@@ -75,17 +67,80 @@ typedef unsigned int SmolBool;
 
 #define SMOL_ALIGNMENT 64
 
+/* Rows wider than this many bytes in storage are scaled in column strips,
+ * so the handful of rows each strip works on stay in L2. 0 turns strips
+ * off. */
+#ifndef SMOL_STRIP_ROW_BYTES
+# define SMOL_STRIP_ROW_BYTES (256 * 1024)
+#endif
+
+/* Strip widths are a multiple of this, which keeps unpacked rows and
+ * precalc slices aligned */
+#define SMOL_STRIP_WIDTH_ALIGN 16
+
+/* Outputs of at least this many bytes are written with non-temporal stores
+ * where the packer supports it, since they won't fit in cache anyway. 0
+ * turns this off. */
+#ifndef SMOL_STREAM_OUTPUT_BYTES
+# define SMOL_STREAM_OUTPUT_BYTES (64 * 1024 * 1024)
+#endif
+
+/* The vertical filters prefetch up to this many bytes of each inrow ahead
+ * of its use. 0 turns prefetching off. */
+#ifndef SMOL_PREFETCH_ROW_BYTES
+# define SMOL_PREFETCH_ROW_BYTES (16 * 1024)
+#endif
+
+#define SMOL_CACHE_LINE_BYTES 64
+
+/* The default allocator backs allocations of at least this many bytes with
+ * their own mappings, and asks for transparent huge pages for them. 0 turns
+ * this off. */
+#ifndef SMOL_HUGEPAGE_MIN_BYTES
+# define SMOL_HUGEPAGE_MIN_BYTES (2 * 1024 * 1024)
+#endif
+
+/* Rounds n up to a multiple of a, which must be a power of two */
+#define SMOL_ALIGN_UP(n, a) (((n) + ((a) - 1)) & ~((__typeof__ (n)) (a) - 1))
+
 #define SMOL_ASSIGN_ALIGNED_TO(x, t, n) (t) __builtin_assume_aligned ((x), (n))
 #define SMOL_ASSIGN_ALIGNED(x, t) SMOL_ASSIGN_ALIGNED_TO ((x), t, SMOL_ALIGNMENT)
 
 #define SMOL_ASSUME_ALIGNED_TO(x, t, n) (x) = SMOL_ASSIGN_ALIGNED_TO ((x), t, (n))
 #define SMOL_ASSUME_ALIGNED(x, t) SMOL_ASSUME_ALIGNED_TO ((x), t, SMOL_ALIGNMENT)
 
-/* Pointer to beginning of storage is stored in *r. This must be passed to smol_free() later. */
-#define smol_alloc_aligned_to(s, a, r) \
-  ({ void *p; *(r) = _SMOL_ALLOC ((s) + (a)); p = (void *) (((uintptr_t) (*(r)) + (a)) & ~((a) - 1)); (p); })
-#define smol_alloc_aligned(s, r) smol_alloc_aligned_to ((s), SMOL_ALIGNMENT, (r))
-#define smol_free(p) _SMOL_FREE(p)
+/* Per-stage instrumentation. Compiles to nothing unless SMOL_WITH_STATS
+ * is defined. */
+#ifdef SMOL_WITH_STATS
+# if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define smol_get_ticks() ((uint64_t) __rdtsc ())
+# else
+#  include <time.h>
+#  define smol_get_ticks() \
+  ({ struct timespec ts; clock_gettime (CLOCK_MONOTONIC, &ts); (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec; })
+# endif
+# define SMOL_STATS_TIME(vertical_ctx, stage, expr) \
+  do { uint64_t t0_ = smol_get_ticks (); expr; \
+      (vertical_ctx)->stats.ticks [(stage)] += smol_get_ticks () - t0_; \
+      (vertical_ctx)->stats.n_calls [(stage)]++; } while (0)
+#else
+# define SMOL_STATS_TIME(vertical_ctx, stage, expr) do { expr; } while (0)
+#endif
+
+#define smol_alloc(allocator, s) ((allocator)->alloc_func ((s), (allocator)->user_data))
+#define smol_free(allocator, p) ((allocator)->free_func ((p), (allocator)->user_data))
+
+/* Pointer to beginning of storage is stored in *r. This must be passed to smol_free() later,
+ * with the same allocator. Without an aligned allocation function, we over-allocate. */
+#define smol_alloc_aligned_to(allocator, s, a, r) \
+  ({ const SmolAllocator *al_ = (allocator); void *p; \
+     if (al_->aligned_alloc_func) \
+         p = *(r) = al_->aligned_alloc_func ((s), (a), al_->user_data); \
+     else \
+     { *(r) = smol_alloc (al_, (s) + (a)); p = (void *) (((uintptr_t) (*(r)) + (a)) & ~((a) - 1)); } \
+     (p); })
+#define smol_alloc_aligned(allocator, s, r) smol_alloc_aligned_to ((allocator), (s), SMOL_ALIGNMENT, (r))
 
 typedef enum
 {
@@ -184,10 +239,17 @@ SmolPixelTypeMeta;
 typedef struct
 {
     uint32_t in_ofs;
-    uint64_t *parts_row [4];
-    uint64_t *row_storage [4];
+    uint64_t *parts_row [5];
+    uint64_t *row_storage;
     uint32_t *in_aligned;
     uint32_t *in_aligned_storage;
+    uint32_t *sink_row;
+    uint32_t *sink_row_storage;
+
+#ifdef SMOL_WITH_STATS
+    /* Accumulated per batch, then added to the SmolScaleCtx */
+    SmolScaleStats stats;
+#endif
 }
 SmolVerticalCtx;
 
@@ -236,14 +298,29 @@ typedef void (SmolVFilterFunc) (const SmolScaleCtx *scale_ctx,
                                          MASK_ITEM (alpha_out, SMOL_ALPHA_BITS), \
                                          MASK_ITEM (gamma_out, SMOL_GAMMA_BITS))
 
-#define SMOL_REPACK_META(order_in, storage_in, alpha_in, gamma_in,      \
-                         order_out, storage_out, alpha_out, gamma_out)  \
+#define SMOL_REPACK_META_PREFIXED(prefix,                                \
+                                  order_in, storage_in, alpha_in, gamma_in, \
+                                  order_out, storage_out, alpha_out, gamma_out) \
     { (((SMOL_REORDER_##order_in##_TO_##order_out) << 10)               \
        | ((SMOL_STORAGE_##storage_in##BPP) << 8) | ((SMOL_ALPHA_##alpha_in) << 6) \
        | ((SMOL_GAMMA_SRGB_##gamma_in) << 5)                            \
        | ((SMOL_STORAGE_##storage_out##BPP) << 3) | ((SMOL_ALPHA_##alpha_out) << 1) \
        | ((SMOL_GAMMA_SRGB_##gamma_out) << 0)), \
-    (SmolRepackRowFunc *) repack_row_##order_in##_##storage_in##_##alpha_in##_##gamma_in##_to_##order_out##_##storage_out##_##alpha_out##_##gamma_out }
+    (SmolRepackRowFunc *) prefix##_##order_in##_##storage_in##_##alpha_in##_##gamma_in##_to_##order_out##_##storage_out##_##alpha_out##_##gamma_out }
+
+#define SMOL_REPACK_META(order_in, storage_in, alpha_in, gamma_in,      \
+                         order_out, storage_out, alpha_out, gamma_out)  \
+    SMOL_REPACK_META_PREFIXED (repack_row,                              \
+                               order_in, storage_in, alpha_in, gamma_in, \
+                               order_out, storage_out, alpha_out, gamma_out)
+
+/* Packers that write with non-temporal stores. They go in a separate table,
+ * since their signatures are the same as those of the regular ones. */
+#define SMOL_REPACK_STREAM_META(order_in, storage_in, alpha_in, gamma_in, \
+                                order_out, storage_out, alpha_out, gamma_out) \
+    SMOL_REPACK_META_PREFIXED (repack_stream_row,                       \
+                               order_in, storage_in, alpha_in, gamma_in, \
+                               order_out, storage_out, alpha_out, gamma_out)
 
 #define SMOL_REPACK_META_LAST { 0xffff, NULL }
 
@@ -254,9 +331,10 @@ typedef struct
 }
 SmolRepackMeta;
 
-#define SMOL_REPACK_ROW_DEF(order_in, storage_in, limb_bits_in, alpha_in, gamma_in, \
-                            order_out, storage_out, limb_bits_out, alpha_out, gamma_out) \
-    static void repack_row_##order_in##_##storage_in##_##alpha_in##_##gamma_in##_to_##order_out##_##storage_out##_##alpha_out##_##gamma_out \
+#define SMOL_REPACK_ROW_DEF_PREFIXED(prefix,                             \
+                                     order_in, storage_in, limb_bits_in, alpha_in, gamma_in, \
+                                     order_out, storage_out, limb_bits_out, alpha_out, gamma_out) \
+    static void prefix##_##order_in##_##storage_in##_##alpha_in##_##gamma_in##_to_##order_out##_##storage_out##_##alpha_out##_##gamma_out \
     (const uint##limb_bits_in##_t * SMOL_RESTRICT row_in,               \
      uint##limb_bits_out##_t * SMOL_RESTRICT row_out,                   \
      uint32_t n_pixels)                                                 \
@@ -265,15 +343,31 @@ SmolRepackMeta;
         SMOL_ASSUME_ALIGNED_TO (row_in, uint##limb_bits_in##_t *, limb_bits_in / 8); \
         SMOL_ASSUME_ALIGNED_TO (row_out, uint##limb_bits_out##_t *, limb_bits_out / 8);
 
+#define SMOL_REPACK_ROW_DEF(order_in, storage_in, limb_bits_in, alpha_in, gamma_in, \
+                            order_out, storage_out, limb_bits_out, alpha_out, gamma_out) \
+    SMOL_REPACK_ROW_DEF_PREFIXED (repack_row,                           \
+                                  order_in, storage_in, limb_bits_in, alpha_in, gamma_in, \
+                                  order_out, storage_out, limb_bits_out, alpha_out, gamma_out)
+
+#define SMOL_REPACK_STREAM_ROW_DEF(order_in, storage_in, limb_bits_in, alpha_in, gamma_in, \
+                                   order_out, storage_out, limb_bits_out, alpha_out, gamma_out) \
+    SMOL_REPACK_ROW_DEF_PREFIXED (repack_stream_row,                    \
+                                  order_in, storage_in, limb_bits_in, alpha_in, gamma_in, \
+                                  order_out, storage_out, limb_bits_out, alpha_out, gamma_out)
+
 #define SMOL_REPACK_ROW_DEF_END }
 
 typedef struct
 {
+    const char *name;
     SmolInitFunc *init_h_func;
     SmolInitFunc *init_v_func;
     SmolHFilterFunc *hfilter_funcs [SMOL_STORAGE_MAX] [SMOL_FILTER_MAX];
     SmolVFilterFunc *vfilter_funcs [SMOL_STORAGE_MAX] [SMOL_FILTER_MAX];
     const SmolRepackMeta *repack_meta;
+
+    /* Streaming variants of some packers, or NULL */
+    const SmolRepackMeta *repack_stream_meta;
 }
 SmolImplementation;
 
@@ -296,6 +390,9 @@ struct SmolScaleCtx
     SmolHFilterFunc *hfilter_func;
     SmolVFilterFunc *vfilter_func;
 
+    /* Where the filters came from, for smol_scale_get_info() */
+    const SmolImplementation *impl_h, *impl_v;
+
     /* User specified, can be NULL */
     SmolPostRowFunc *post_row_func;
     void *user_data;
@@ -307,8 +404,38 @@ struct SmolScaleCtx
 
     void *precalc_x_storage;
 
+    /* Copied from the context's or the global allocator at init. Copies of
+     * the context share it, so buffers they allocate can be freed through
+     * the original. */
+    SmolAllocator allocator;
+
     uint32_t width_bilin_out, height_bilin_out;
     unsigned int width_halvings, height_halvings;
+
+    /* If set, rows are filtered vertically first, through this copy of the
+     * context that keeps the input width, then horizontally once per outrow */
+    SmolScaleCtx *vfirst_ctx;
+
+    /* Set by init_h_func if precalc_x holds offsets from the start of the
+     * row, rather than from the previous sample */
+    uint8_t precalc_x_is_absolute;
+
+    /* If nonzero, direct output is done in column strips this many pixels
+     * wide. Strip contexts unpack their part of the input row unpack_ofs
+     * parts into the buffer, and the horizontal filter reads from
+     * hfilter_ofs. precalc_x_strips has the offsets rebased per strip. */
+    uint32_t strip_width_out;
+    uint16_t *precalc_x_strips;
+    uint32_t unpack_ofs, hfilter_ofs;
+
+    /* Like pack_row_func, but with non-temporal stores, or NULL if there's
+     * no such variant. Used for big outputs to pixels_out that nothing reads
+     * back; see want_stream_output(). */
+    SmolRepackRowFunc *pack_row_stream_func;
+
+#ifdef SMOL_WITH_STATS
+    SmolScaleStats stats;
+#endif
 };
 
 #define SRGB_LINEAR_BITS 11
@@ -3,9 +3,13 @@
 /* Copyright © 2019-2023 Hans Petter Jansson. See COPYING for details. */
 
 #include <assert.h> /* assert */
-#include <stdlib.h> /* malloc, free, alloca */
-#include <string.h> /* memset */
+#include <stdlib.h> /* malloc, free, getenv */
+#include <string.h> /* memset, memcmp, strcmp */
 #include <limits.h>
+#ifdef __linux__
+# include <sys/mman.h> /* mmap, munmap, madvise */
+# include <unistd.h> /* sysconf */
+#endif
 #include "smolscale-private.h"
 
 /* ----------------------- *
@@ -74,6 +78,21 @@ static const SmolPixelType pixel_type_u32_le [SMOL_PIXEL_MAX] =
     SMOL_PIXEL_BGR8
 };
 
+/* For smol_scale_get_info(). Keep in sync with the private SmolFilterType enum */
+static const char * const filter_names [SMOL_FILTER_MAX] =
+{
+    "copy",
+    "one",
+    "bilinear-0h",
+    "bilinear-1h",
+    "bilinear-2h",
+    "bilinear-3h",
+    "bilinear-4h",
+    "bilinear-5h",
+    "bilinear-6h",
+    "box"
+};
+
 /* ----------------------------------- *
  * sRGB/linear conversion: Shared code *
  * ----------------------------------- */
@@ -477,6 +496,259 @@ pick_filter_params (uint32_t dim_in,
     }
 }
 
+/* Set with smol_set_pass_order() */
+static int global_pass_order = SMOL_PASS_ORDER_AUTO;
+
+/* Filtering vertically first makes the vertical filter work on input-width
+ * rows, but the horizontal filter then runs once per outrow instead of once
+ * per inrow. Estimates the pixels touched by each pass order and returns
+ * TRUE if vertical-first is cheaper, or follows the global pass order. */
+static uint8_t
+pick_vertical_first (uint32_t width_in,
+                     uint32_t width_out,
+                     uint32_t height_in,
+                     uint32_t height_out,
+                     uint32_t height_bilin_out,
+                     SmolFilterType filter_h,
+                     SmolFilterType filter_v)
+{
+    SmolPassOrder pass_order = __atomic_load_n (&global_pass_order, __ATOMIC_ACQUIRE);
+    uint64_t n_inrows, n_vrows, hfilter_cost;
+    uint64_t cost_h_first, cost_v_first;
+
+    if (filter_h == SMOL_FILTER_COPY || pass_order == SMOL_PASS_ORDER_HORIZONTAL_FIRST)
+        return FALSE;
+
+    /* Inrows that get unpacked, and rows the vertical filter produces or
+     * accumulates */
+    if (filter_v == SMOL_FILTER_BOX)
+    {
+        n_inrows = height_in;
+        n_vrows = height_in;
+    }
+    else if (filter_v >= SMOL_FILTER_BILINEAR_0H && filter_v <= SMOL_FILTER_BILINEAR_6H)
+    {
+        n_inrows = MIN (height_in, (uint64_t) height_bilin_out * 2);
+        n_vrows = height_bilin_out;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    if (pass_order == SMOL_PASS_ORDER_VERTICAL_FIRST)
+        return TRUE;
+
+    hfilter_cost = (uint64_t) width_in + width_out;
+
+    cost_h_first = n_inrows * (width_in + hfilter_cost)
+        + n_vrows * width_out;
+    cost_v_first = n_inrows * width_in
+        + n_vrows * width_in
+        + height_out * (width_in + hfilter_cost);
+
+    /* The estimate is rough, so only switch when it's clearly cheaper */
+    return cost_v_first * 5 < cost_h_first * 4 ? TRUE : FALSE;
+}
+
+/* Column strips only pay off when the vertical filter reuses rows across
+ * outrows. The box filter reduces rows to the output width as they're
+ * unpacked, and doesn't map to strips exactly, so it's left out. */
+static uint8_t
+can_use_strips (SmolFilterType filter_h,
+                SmolFilterType filter_v,
+                uint8_t vertical_first)
+{
+    if (vertical_first || filter_h == SMOL_FILTER_BOX)
+        return FALSE;
+
+    return filter_v == SMOL_FILTER_BOX
+        || (filter_v >= SMOL_FILTER_BILINEAR_0H && filter_v <= SMOL_FILTER_BILINEAR_6H);
+}
+
+/* Whether to set aside storage for per-strip precalc offsets. This must not
+ * depend on the storage type, so it assumes 128bpp, the widest. */
+static uint8_t
+want_strip_precalc (uint32_t width_in,
+                    uint32_t width_out,
+                    SmolFilterType filter_h,
+                    SmolFilterType filter_v,
+                    uint8_t vertical_first)
+{
+    return SMOL_STRIP_ROW_BYTES
+        && can_use_strips (filter_h, filter_v, vertical_first)
+        && filter_h >= SMOL_FILTER_BILINEAR_0H && filter_h <= SMOL_FILTER_BILINEAR_6H
+        && (uint64_t) MAX (width_in, width_out) * 2 * sizeof (uint64_t) > SMOL_STRIP_ROW_BYTES;
+}
+
+/* Returns the strip width in output pixels, or 0 if the image should be
+ * done in one go */
+static uint32_t
+pick_strip_width (const SmolScaleCtx *scale_ctx)
+{
+    uint64_t bytes_per_pixel, width;
+
+    if (!SMOL_STRIP_ROW_BYTES
+        || !can_use_strips (scale_ctx->filter_h, scale_ctx->filter_v,
+                            scale_ctx->vfirst_ctx ? TRUE : FALSE))
+        return 0;
+
+    /* Absolute offsets wrap at 16 bits, so strips can't be located in them */
+    if (scale_ctx->precalc_x_is_absolute && scale_ctx->width_in > UINT16_MAX)
+        return 0;
+
+    bytes_per_pixel = (scale_ctx->storage_type == SMOL_STORAGE_128BPP ? 2 : 1) * sizeof (uint64_t);
+
+    if ((uint64_t) MAX (scale_ctx->width_in, scale_ctx->width_out) * bytes_per_pixel
+        <= SMOL_STRIP_ROW_BYTES)
+        return 0;
+
+    /* Size strips so the wider of the input and output parts fits */
+    width = SMOL_STRIP_ROW_BYTES / bytes_per_pixel;
+    if (scale_ctx->width_in > scale_ctx->width_out)
+        width = width * scale_ctx->width_out / scale_ctx->width_in;
+
+    width &= ~(uint64_t) (SMOL_STRIP_WIDTH_ALIGN - 1);
+    width = MAX (width, SMOL_STRIP_WIDTH_ALIGN);
+
+    return width < scale_ctx->width_out ? width : 0;
+}
+
+/* Same as the offsets in precalc_bilinear_array(), but not truncated to
+ * 16 bits */
+static uint32_t
+get_bilinear_ofs (uint32_t dim_in,
+                  uint32_t dim_out,
+                  uint32_t index)
+{
+    uint64_t fracF, frac_stepF, ofs;
+
+    if (dim_in > dim_out)
+    {
+        frac_stepF = (dim_in * SMOL_BILIN_MULTIPLIER) / dim_out;
+        fracF = (frac_stepF - SMOL_BILIN_MULTIPLIER) / 2;
+    }
+    else
+    {
+        frac_stepF = ((dim_in - 1) * SMOL_BILIN_MULTIPLIER)
+            / (dim_out > 1 ? (dim_out - 1) : 1);
+        fracF = 0;
+    }
+
+    ofs = (fracF + frac_stepF * index) / SMOL_BILIN_MULTIPLIER;
+    return MIN (ofs, dim_in - 2);
+}
+
+/* Gets the input pixels [first .. end> that the strip starting at output
+ * pixel x0 reads. first is aligned, so the unpacked parts are too. */
+static void
+get_strip_input_range (const SmolScaleCtx *scale_ctx,
+                       uint32_t x0,
+                       uint32_t *first_out,
+                       uint32_t *end_out)
+{
+    uint32_t x1 = MIN (x0 + scale_ctx->strip_width_out, scale_ctx->width_out);
+    uint32_t b0, b1;
+
+    if (scale_ctx->filter_h == SMOL_FILTER_COPY)
+    {
+        *first_out = x0;
+        *end_out = x1;
+        return;
+    }
+
+    if (scale_ctx->filter_h == SMOL_FILTER_ONE)
+    {
+        *first_out = 0;
+        *end_out = 1;
+        return;
+    }
+
+    /* Bilinear. Each sample reads two pixels. */
+    b0 = x0 << scale_ctx->width_halvings;
+    b1 = x1 << scale_ctx->width_halvings;
+
+    *first_out = get_bilinear_ofs (scale_ctx->width_in, scale_ctx->width_bilin_out, b0)
+        & ~(uint32_t) (SMOL_STRIP_WIDTH_ALIGN - 1);
+    *end_out = get_bilinear_ofs (scale_ctx->width_in, scale_ctx->width_bilin_out, b1 - 1) + 2;
+}
+
+/* For offsets relative to the previous sample, makes a copy of precalc_x
+ * where each strip's first offset is relative to the start of its input */
+static void
+init_strip_precalc (SmolScaleCtx *scale_ctx,
+                    uint16_t *precalc_x_strips)
+{
+    uint32_t x0;
+
+    if (scale_ctx->filter_h < SMOL_FILTER_BILINEAR_0H
+        || scale_ctx->filter_h > SMOL_FILTER_BILINEAR_6H
+        || scale_ctx->precalc_x_is_absolute)
+        return;
+
+    memcpy (precalc_x_strips, scale_ctx->precalc_x,
+            (scale_ctx->width_bilin_out + 1) * 2 * sizeof (uint16_t));
+
+    for (x0 = scale_ctx->strip_width_out; x0 < scale_ctx->width_out; x0 += scale_ctx->strip_width_out)
+    {
+        uint32_t b0 = x0 << scale_ctx->width_halvings;
+        uint32_t first, end;
+
+        get_strip_input_range (scale_ctx, x0, &first, &end);
+        precalc_x_strips [b0 * 2] = get_bilinear_ofs (scale_ctx->width_in,
+                                                      scale_ctx->width_bilin_out,
+                                                      b0) - first;
+    }
+
+    scale_ctx->precalc_x_strips = precalc_x_strips;
+}
+
+/* Sets up a context for the strip starting at output pixel x0 */
+static void
+init_strip_ctx (const SmolScaleCtx *scale_ctx,
+                SmolScaleCtx *strip_ctx,
+                uint32_t x0)
+{
+    uint32_t n_parts = scale_ctx->storage_type == SMOL_STORAGE_128BPP ? 2 : 1;
+    uint32_t bytes_per_pixel_in =
+        pixel_type_meta [scale_ctx->pixel_type_in].storage == SMOL_STORAGE_24BPP ? 3 : 4;
+    uint32_t first, end;
+
+    get_strip_input_range (scale_ctx, x0, &first, &end);
+
+    *strip_ctx = *scale_ctx;
+
+    strip_ctx->pixels_in += (size_t) first * bytes_per_pixel_in;
+    strip_ctx->width_in = end - first;
+    strip_ctx->width_out = MIN (scale_ctx->strip_width_out, scale_ctx->width_out - x0);
+    strip_ctx->width_bilin_out = strip_ctx->width_out;
+    strip_ctx->post_row_func = NULL;
+    strip_ctx->strip_width_out = 0;
+
+    /* The unpacked input goes where it would be in a whole row. Absolute
+     * offsets then work as they are; the others are rebased. */
+    strip_ctx->unpack_ofs = first * n_parts;
+    strip_ctx->hfilter_ofs = first * n_parts;
+
+    if (scale_ctx->filter_h >= SMOL_FILTER_BILINEAR_0H
+        && scale_ctx->filter_h <= SMOL_FILTER_BILINEAR_6H)
+    {
+        uint32_t b0 = x0 << scale_ctx->width_halvings;
+
+        strip_ctx->width_bilin_out = strip_ctx->width_out << scale_ctx->width_halvings;
+
+        if (scale_ctx->precalc_x_is_absolute)
+        {
+            strip_ctx->precalc_x = scale_ctx->precalc_x + b0 * 2;
+            strip_ctx->hfilter_ofs = 0;
+        }
+        else
+        {
+            strip_ctx->precalc_x = scale_ctx->precalc_x_strips + b0 * 2;
+        }
+    }
+}
+
 /* ------------------- *
  * Scaling: Outer loop *
  * ------------------- */
@@ -488,61 +760,379 @@ outrow_ofs_to_pointer (const SmolScaleCtx *scale_ctx,
     return scale_ctx->pixels_out + scale_ctx->rowstride_out * outrow_ofs;
 }
 
+#ifdef SMOL_WITH_STATS
+
+/* Time spent in stages that are called from the vertical filter */
+static uint64_t
+get_nested_ticks (const SmolScaleStats *stats)
+{
+    return stats->ticks [SMOL_STAGE_UNPACK]
+        + stats->ticks [SMOL_STAGE_HFILTER]
+        + stats->ticks [SMOL_STAGE_PACK];
+}
+
+#endif
+
+/* The vertical-first context's packer keeps the vertically filtered row
+ * as parts, in input width, for the horizontal filter to pick up */
+static void
+copy_parts_64bpp (const void *row_in, void *row_out, uint32_t n_pixels)
+{
+    memcpy (row_out, row_in, n_pixels * sizeof (uint64_t));
+}
+
+static void
+copy_parts_128bpp (const void *row_in, void *row_out, uint32_t n_pixels)
+{
+    memcpy (row_out, row_in, n_pixels * 2 * sizeof (uint64_t));
+}
+
+static void
+scale_outrow_vertical_first (const SmolScaleCtx *scale_ctx,
+                             SmolVerticalCtx *vertical_ctx,
+                             uint32_t outrow_index,
+                             uint32_t *row_out)
+{
+    const SmolScaleCtx *vfirst_ctx = scale_ctx->vfirst_ctx;
+    uint64_t *vfiltered = vertical_ctx->parts_row [4];
+
+    vfirst_ctx->vfilter_func (vfirst_ctx,
+                              vertical_ctx,
+                              outrow_index,
+                              (uint32_t *) vfiltered);
+
+    /* parts_row [3] only holds unpacked inrows during vertical filtering,
+     * so it's free now */
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_HFILTER,
+                     scale_ctx->hfilter_func (scale_ctx,
+                                              vfiltered,
+                                              vertical_ctx->parts_row [3]));
+    SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_PACK,
+                     scale_ctx->pack_row_func (vertical_ctx->parts_row [3],
+                                               row_out,
+                                               scale_ctx->width_out));
+}
+
 static void
 scale_outrow (const SmolScaleCtx *scale_ctx,
               SmolVerticalCtx *vertical_ctx,
               uint32_t outrow_index,
               uint32_t *row_out)
 {
-    scale_ctx->vfilter_func (scale_ctx,
-                             vertical_ctx,
-                             outrow_index,
-                             row_out);
+#ifdef SMOL_WITH_STATS
+    uint64_t nested_ticks = get_nested_ticks (&vertical_ctx->stats);
+    uint64_t t0 = smol_get_ticks ();
+#endif
+
+    if (scale_ctx->vfirst_ctx)
+        scale_outrow_vertical_first (scale_ctx, vertical_ctx, outrow_index, row_out);
+    else
+        scale_ctx->vfilter_func (scale_ctx,
+                                 vertical_ctx,
+                                 outrow_index,
+                                 row_out);
+
+#ifdef SMOL_WITH_STATS
+    vertical_ctx->stats.ticks [SMOL_STAGE_VFILTER] += smol_get_ticks () - t0
+        - (get_nested_ticks (&vertical_ctx->stats) - nested_ticks);
+    vertical_ctx->stats.n_calls [SMOL_STAGE_VFILTER]++;
+#endif
 
     if (scale_ctx->post_row_func)
-        scale_ctx->post_row_func (row_out, scale_ctx->width_out, scale_ctx->user_data);
+        SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_POST_ROW,
+                         scale_ctx->post_row_func (row_out, scale_ctx->width_out,
+                                                   scale_ctx->user_data));
 }
 
-static void
-do_rows (const SmolScaleCtx *scale_ctx,
-         void *outrows_dest,
-         uint32_t row_out_index,
-         uint32_t n_rows)
+/* Four rows for the filters, plus one for the vertically filtered row when
+ * going vertical-first */
+#define N_STORED_ROWS_MAX 5
+
+static uint32_t
+get_n_stored_rows (const SmolScaleCtx *scale_ctx)
+{
+    return scale_ctx->vfirst_ctx ? 5 : 4;
+}
+
+static size_t
+get_stored_row_size (const SmolScaleCtx *scale_ctx)
 {
-    SmolVerticalCtx vertical_ctx = { 0 };
     uint32_t n_parts_per_pixel = 1;
-    uint32_t n_stored_rows = 4;
-    uint32_t i;
 
     if (scale_ctx->storage_type == SMOL_STORAGE_128BPP)
         n_parts_per_pixel = 2;
 
+    return SMOL_ALIGN_UP ((size_t) MAX (scale_ctx->width_in, scale_ctx->width_out)
+                          * n_parts_per_pixel * sizeof (uint64_t),
+                          SMOL_ALIGNMENT);
+}
+
+static size_t
+get_in_aligned_size (const SmolScaleCtx *scale_ctx)
+{
+    return SMOL_ALIGN_UP ((size_t) scale_ctx->width_in * sizeof (uint32_t),
+                          SMOL_ALIGNMENT);
+}
+
+static size_t
+get_sink_row_size (const SmolScaleCtx *scale_ctx)
+{
+    return SMOL_ALIGN_UP ((size_t) scale_ctx->width_out * sizeof (uint32_t),
+                          SMOL_ALIGNMENT);
+}
+
+static size_t
+get_scratch_size (const SmolScaleCtx *scale_ctx)
+{
+    return get_stored_row_size (scale_ctx) * get_n_stored_rows (scale_ctx)
+        + get_in_aligned_size (scale_ctx)
+        + get_sink_row_size (scale_ctx)
+        + SMOL_ALIGNMENT - 1;
+}
+
+/* If scratch is NULL, memory will be allocated as needed. Otherwise it must
+ * point to at least get_scratch_size() bytes. */
+static void
+init_vertical_ctx (const SmolScaleCtx *scale_ctx,
+                   SmolVerticalCtx *vertical_ctx,
+                   void *scratch)
+{
+    size_t row_size = get_stored_row_size (scale_ctx);
+    uint32_t n_rows = get_n_stored_rows (scale_ctx);
+    char *p = NULL;
+    uint32_t i;
+
+    memset (vertical_ctx, 0, sizeof (*vertical_ctx));
+
     /* Must be one less, or this test in update_vertical_ctx() will wrap around:
      * if (new_in_ofs == vertical_ctx->in_ofs + 1) { ... } */
-    vertical_ctx.in_ofs = UINT_MAX - 1;
+    vertical_ctx->in_ofs = UINT_MAX - 1;
+
+    if (scratch)
+    {
+        p = (char *) SMOL_ALIGN_UP ((uintptr_t) scratch, SMOL_ALIGNMENT);
+
+        /* Provide the alignment and sink buffers up front, so they won't
+         * be allocated on demand. */
+        vertical_ctx->in_aligned = (uint32_t *) (p + row_size * n_rows);
+        vertical_ctx->sink_row = (uint32_t *) (p + row_size * n_rows
+                                               + get_in_aligned_size (scale_ctx));
+    }
+    else
+    {
+        /* The rows share a block, so wide ones can get huge pages */
+        p = smol_alloc_aligned (&scale_ctx->allocator, row_size * n_rows,
+                                &vertical_ctx->row_storage);
+    }
+
+    for (i = 0; i < n_rows; i++)
+        vertical_ctx->parts_row [i] = (uint64_t *) (p + row_size * i);
+}
+
+static void
+finalize_vertical_ctx (const SmolScaleCtx *scale_ctx,
+                       SmolVerticalCtx *vertical_ctx)
+{
+#ifdef SMOL_WITH_STATS
+    uint32_t i;
+
+    /* Batches may run concurrently, so add to the shared totals atomically.
+     * These are the only fields modified after init. */
+    for (i = 0; i < SMOL_STAGE_MAX; i++)
+    {
+        __atomic_fetch_add ((uint64_t *) &scale_ctx->stats.ticks [i],
+                            vertical_ctx->stats.ticks [i], __ATOMIC_RELAXED);
+        __atomic_fetch_add ((uint64_t *) &scale_ctx->stats.n_calls [i],
+                            vertical_ctx->stats.n_calls [i], __ATOMIC_RELAXED);
+    }
+#endif
+
+    if (vertical_ctx->row_storage)
+        smol_free (&scale_ctx->allocator, vertical_ctx->row_storage);
+
+    /* Used to align row data if needed. May be allocated in scale_horizontal(). */
+    if (vertical_ctx->in_aligned_storage)
+        smol_free (&scale_ctx->allocator, vertical_ctx->in_aligned_storage);
 
-    for (i = 0; i < n_stored_rows; i++)
+    /* Used to hold packed rows for the sink. May be allocated in scale_rows(). */
+    if (vertical_ctx->sink_row_storage)
+        smol_free (&scale_ctx->allocator, vertical_ctx->sink_row_storage);
+}
+
+/* If row_sink_func is set, rows are packed into a private buffer and handed
+ * to it one at a time, and outrows_dest is ignored. */
+static void
+scale_rows (const SmolScaleCtx *scale_ctx,
+            SmolVerticalCtx *vertical_ctx,
+            void *outrows_dest,
+            uint32_t row_out_index,
+            uint32_t n_rows,
+            SmolRowSinkFunc *row_sink_func,
+            void *sink_user_data)
+{
+    uint32_t i;
+
+    if (row_sink_func)
+    {
+        if (!vertical_ctx->sink_row)
+            vertical_ctx->sink_row =
+                smol_alloc_aligned (&scale_ctx->allocator,
+                                    get_sink_row_size (scale_ctx),
+                                    &vertical_ctx->sink_row_storage);
+
+        for (i = row_out_index; i < row_out_index + n_rows; i++)
+        {
+            scale_outrow (scale_ctx, vertical_ctx, i, vertical_ctx->sink_row);
+            row_sink_func (vertical_ctx->sink_row, i, scale_ctx->width_out, sink_user_data);
+        }
+
+        return;
+    }
+
+    /* In-place with unscaled height and wider output rows. Each output row
+     * only overlaps input rows at or after its own, so go bottom-up. */
+    if (scale_ctx->pixels_out == scale_ctx->pixels_in
+        && scale_ctx->filter_v == SMOL_FILTER_COPY
+        && scale_ctx->rowstride_out > scale_ctx->rowstride_in)
     {
-        vertical_ctx.parts_row [i] =
-            smol_alloc_aligned (MAX (scale_ctx->width_in, scale_ctx->width_out)
-                                * n_parts_per_pixel * sizeof (uint64_t),
-                                &vertical_ctx.row_storage [i]);
+        outrows_dest = (char *) outrows_dest
+            + (size_t) scale_ctx->rowstride_out * n_rows;
+
+        for (i = row_out_index + n_rows; i > row_out_index; i--)
+        {
+            outrows_dest = (char *) outrows_dest - scale_ctx->rowstride_out;
+            scale_outrow (scale_ctx, vertical_ctx, i - 1, outrows_dest);
+        }
+
+        return;
     }
 
     for (i = row_out_index; i < row_out_index + n_rows; i++)
     {
-        scale_outrow (scale_ctx, &vertical_ctx, i, outrows_dest);
+        scale_outrow (scale_ctx, vertical_ctx, i, outrows_dest);
         outrows_dest = (char *) outrows_dest + scale_ctx->rowstride_out;
     }
+}
 
-    for (i = 0; i < n_stored_rows; i++)
+/* Scales the rows one column strip at a time, so each strip's rows stay in
+ * cache across outrows. The post-row function runs once the rows are whole. */
+static void
+scale_rows_in_strips (const SmolScaleCtx *scale_ctx,
+                      SmolVerticalCtx *vertical_ctx,
+                      void *outrows_dest,
+                      uint32_t row_out_index,
+                      uint32_t n_rows)
+{
+    uint32_t bytes_per_pixel_out =
+        pixel_type_meta [scale_ctx->pixel_type_out].storage == SMOL_STORAGE_24BPP ? 3 : 4;
+    char *row_out;
+    uint32_t x0, i;
+
+    /* The alignment buffer would otherwise be sized for the first strip */
+    if (!vertical_ctx->in_aligned)
+        vertical_ctx->in_aligned = smol_alloc_aligned (&scale_ctx->allocator,
+                                                       get_in_aligned_size (scale_ctx),
+                                                       &vertical_ctx->in_aligned_storage);
+
+    for (x0 = 0; x0 < scale_ctx->width_out; x0 += scale_ctx->strip_width_out)
     {
-        smol_free (vertical_ctx.row_storage [i]);
+        SmolScaleCtx strip_ctx;
+
+        init_strip_ctx (scale_ctx, &strip_ctx, x0);
+
+        /* Cached rows belong to the previous strip */
+        vertical_ctx->in_ofs = UINT_MAX - 1;
+
+        row_out = (char *) outrows_dest + (size_t) x0 * bytes_per_pixel_out;
+
+        for (i = row_out_index; i < row_out_index + n_rows; i++)
+        {
+            scale_outrow (&strip_ctx, vertical_ctx, i, (uint32_t *) row_out);
+            row_out += scale_ctx->rowstride_out;
+        }
     }
 
-    /* Used to align row data if needed. May be allocated in scale_horizontal(). */
-    if (vertical_ctx.in_aligned)
-        smol_free (vertical_ctx.in_aligned_storage);
+    if (!scale_ctx->post_row_func)
+        return;
+
+    row_out = outrows_dest;
+
+    for (i = 0; i < n_rows; i++)
+    {
+        SMOL_STATS_TIME (vertical_ctx, SMOL_STAGE_POST_ROW,
+                         scale_ctx->post_row_func ((uint32_t *) row_out, scale_ctx->width_out,
+                                                   scale_ctx->user_data));
+        row_out += scale_ctx->rowstride_out;
+    }
+}
+
+/* Bypass the cache when writing big outputs, so the input and row buffers
+ * stay in it. Not if a post-row function would read the rows right back. */
+static SmolBool
+want_stream_output (const SmolScaleCtx *scale_ctx)
+{
+    return SMOL_STREAM_OUTPUT_BYTES
+        && scale_ctx->pack_row_stream_func
+        && scale_ctx->pixels_out
+        && !scale_ctx->post_row_func
+        && (uint64_t) scale_ctx->rowstride_out * scale_ctx->height_out >= SMOL_STREAM_OUTPUT_BYTES;
+}
+
+/* Picks the store and strip variants for the rows, which depend on where
+ * they go. Called per image, since smol_scale_many() swaps the buffers. */
+static void
+scale_rows_auto (const SmolScaleCtx *scale_ctx,
+                 SmolVerticalCtx *vertical_ctx,
+                 void *outrows_dest,
+                 uint32_t row_out_index,
+                 uint32_t n_rows,
+                 SmolRowSinkFunc *row_sink_func,
+                 void *sink_user_data)
+{
+    const SmolScaleCtx *rows_ctx = scale_ctx;
+    SmolScaleCtx stream_ctx;
+
+    /* Only stream into pixels_out. Sink rows and other caller buffers are
+     * likely to be read right away, so they're better off in the cache. */
+    if (want_stream_output (scale_ctx)
+        && !row_sink_func
+        && outrows_dest == outrow_ofs_to_pointer (scale_ctx, row_out_index))
+    {
+        stream_ctx = *scale_ctx;
+        stream_ctx.pack_row_func = scale_ctx->pack_row_stream_func;
+        rows_ctx = &stream_ctx;
+    }
+
+    /* Sinks take whole rows, and in-place output could overwrite input
+     * that a later strip needs */
+    if (scale_ctx->strip_width_out
+        && !row_sink_func
+        && scale_ctx->pixels_out != scale_ctx->pixels_in)
+    {
+        scale_rows_in_strips (rows_ctx, vertical_ctx, outrows_dest, row_out_index, n_rows);
+    }
+    else
+    {
+        scale_rows (rows_ctx, vertical_ctx, outrows_dest, row_out_index, n_rows,
+                    row_sink_func, sink_user_data);
+    }
+}
+
+static void
+do_rows (const SmolScaleCtx *scale_ctx,
+         void *scratch,
+         void *outrows_dest,
+         uint32_t row_out_index,
+         uint32_t n_rows,
+         SmolRowSinkFunc *row_sink_func,
+         void *sink_user_data)
+{
+    SmolVerticalCtx vertical_ctx;
+
+    init_vertical_ctx (scale_ctx, &vertical_ctx, scratch);
+    scale_rows_auto (scale_ctx, &vertical_ctx, outrows_dest, row_out_index, n_rows,
+                     row_sink_func, sink_user_data);
+    finalize_vertical_ctx (scale_ctx, &vertical_ctx);
 }
 
 /* -------------------- *
@@ -595,6 +1185,92 @@ get_host_pixel_type (SmolPixelType pixel_type)
     return pixel_type;
 }
 
+/* ----------------- *
+ * Memory allocation *
+ * ----------------- */
+
+/* Allocations from the default allocator are preceded by a header. For a
+ * mapping, it holds the mapping's size and the allocation's offset into it;
+ * for malloc(), the size is 0. It's the size of a malloc() alignment unit,
+ * so that's preserved. */
+#define ALLOC_HEADER_SIZE 16
+
+/* Transparent huge pages only back whole, aligned ranges of this size */
+#define HUGEPAGE_BYTES (2 * 1024 * 1024)
+
+static void *
+default_alloc (size_t size, void *user_data)
+{
+    size_t *header;
+
+    SMOL_UNUSED (user_data);
+
+#ifdef MADV_HUGEPAGE
+    /* Give big buffers their own mapping, so the kernel can back them with
+     * huge pages. The pages are placed on first touch, which happens in the
+     * allocating thread; for scratch buffers, that's the worker's. */
+    if (SMOL_HUGEPAGE_MIN_BYTES > 0 && size >= SMOL_HUGEPAGE_MIN_BYTES)
+    {
+        size_t page_size = sysconf (_SC_PAGESIZE);
+        size_t map_size = SMOL_ALIGN_UP (size, (size_t) HUGEPAGE_BYTES) + HUGEPAGE_BYTES;
+        char *map, *start, *data, *end;
+
+        map = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED)
+        {
+            /* Start the buffer on a huge page boundary, with the header in
+             * the small page before it, and round it up to whole huge pages
+             * so no part of it is left to small ones. Give back the slack. */
+            data = (char *) SMOL_ALIGN_UP ((uintptr_t) map + page_size, HUGEPAGE_BYTES);
+            start = data - page_size;
+            end = data + SMOL_ALIGN_UP (size, (size_t) HUGEPAGE_BYTES);
+
+            if (start > map)
+                munmap (map, start - map);
+            if (end < map + map_size)
+                munmap (end, map + map_size - end);
+
+            /* Just a hint; the mapping works either way */
+            madvise (data, end - data, MADV_HUGEPAGE);
+
+            header = (size_t *) (data - ALLOC_HEADER_SIZE);
+            header [0] = end - start;
+            header [1] = page_size;
+            return data;
+        }
+    }
+#endif
+
+    header = malloc (size + ALLOC_HEADER_SIZE);
+    if (!header)
+        return NULL;
+
+    header [0] = 0;
+    return (char *) header + ALLOC_HEADER_SIZE;
+}
+
+static void
+default_free (void *p, void *user_data)
+{
+    size_t *header = (size_t *) ((char *) p - ALLOC_HEADER_SIZE);
+
+    SMOL_UNUSED (user_data);
+
+#ifdef MADV_HUGEPAGE
+    if (header [0])
+    {
+        munmap ((char *) p - header [1], header [0]);
+        return;
+    }
+#endif
+
+    free (header);
+}
+
+static const SmolAllocator default_allocator = { default_alloc, default_free, NULL, NULL };
+static SmolAllocator global_allocator = { default_alloc, default_free, NULL, NULL };
+
 /* ---------------------- *
  * Context initialization *
  * ---------------------- */
@@ -653,7 +1329,7 @@ find_repacks (const SmolImplementation **implementations,
               const SmolRepackMeta **repack_in, const SmolRepackMeta **repack_out)
 {
     int impl_in, impl_out;
-    const SmolRepackMeta *meta_in, *meta_out = NULL;
+    const SmolRepackMeta *meta_in = NULL, *meta_out = NULL;
     uint16_t sig_in_to_mid, sig_mid_to_out;
     uint16_t sig_mask;
     int reorder_dest_alpha_ch;
@@ -703,7 +1379,7 @@ find_repacks (const SmolImplementation **implementations,
                     do_reorder (order_mid, order_out,
                                 reorder_meta [SMOL_REPACK_SIGNATURE_GET_REORDER (meta_out->signature)].dest);
 
-                    if (*((uint32_t *) order_out) == *((uint32_t *) pmeta_out->order))
+                    if (!memcmp (order_out, pmeta_out->order, sizeof (order_out)))
                     {
                         /* Success */
                         goto out;
@@ -720,40 +1396,295 @@ out:
 
 #define IMPLEMENTATION_MAX 8
 
-/* scale_ctx->storage_type must be initialized first by pick_filter_params() */
-static void
-get_implementations (SmolScaleCtx *scale_ctx)
+typedef enum
+{
+    SMOL_INIT_STATE_NONE,
+    SMOL_INIT_STATE_BUSY,
+    SMOL_INIT_STATE_DONE
+}
+SmolInitState;
+
+typedef struct
+{
+    SmolRepackRowFunc *unpack_row_func;
+    SmolRepackRowFunc *pack_row_func;
+    SmolRepackRowFunc *pack_row_stream_func;
+    int state;
+}
+SmolRepackCacheEntry;
+
+/* Implementation lookups are done once per process and shared by all
+ * contexts. Repacks are resolved on demand, since there are many possible
+ * combinations and most programs only use a few of them. */
+typedef struct
 {
-    SmolPixelType ptype_in, ptype_out;
-    const SmolPixelTypeMeta *pmeta_in, *pmeta_out;
-    const SmolRepackMeta *rmeta_in, *rmeta_out;
-    SmolAlphaType internal_alpha = SMOL_ALPHA_PREMUL8;
     const SmolImplementation *implementations [IMPLEMENTATION_MAX];
-    int i = 0;
 
-    /* Enumerate implementations, preferred first */
+    /* Preferred implementation for each filter, or NULL if unsupported */
+    const SmolImplementation *hfilter_impls [SMOL_STORAGE_MAX] [SMOL_FILTER_MAX];
+    const SmolImplementation *vfilter_impls [SMOL_STORAGE_MAX] [SMOL_FILTER_MAX];
 
+    /* Indexed by host pixel types */
+    SmolRepackCacheEntry repacks [SMOL_PIXEL_MAX] [SMOL_PIXEL_MAX] [SMOL_STORAGE_MAX] [SMOL_GAMMA_MAX];
+}
+SmolDispatch;
+
+/* Which implementations to prefer. Each selection gets its own dispatch
+ * table, so contexts created under an override don't share cached lookups
+ * with the others. */
+typedef enum
+{
+    SMOL_SELECT_AUTO,
+    SMOL_SELECT_GENERIC,
+    SMOL_SELECT_AVX2,
+
+    SMOL_SELECT_MAX
+}
+SmolSelection;
+
+static const char * const selection_names [SMOL_SELECT_MAX] =
+{
+    "auto",
+    "generic",
+    "avx2"
+};
+
+static SmolDispatch global_dispatch [SMOL_SELECT_MAX];
+static int global_dispatch_state [SMOL_SELECT_MAX];
+
+/* Negative until set by the API or the environment */
+static int global_selection = -1;
+
+static SmolBool
+selection_is_available (SmolSelection selection)
+{
+    switch (selection)
+    {
+        case SMOL_SELECT_AUTO:
+        case SMOL_SELECT_GENERIC:
+            return TRUE;
+        case SMOL_SELECT_AVX2:
 #ifdef SMOL_WITH_AVX2
-    if (have_avx2 ())
-        implementations [i++] = _smol_get_avx2_implementation ();
+            return have_avx2 ();
+#else
+            return FALSE;
 #endif
-    implementations [i++] = _smol_get_generic_implementation ();
-    implementations [i] = NULL;
+        default:
+            break;
+    }
 
-    /* Install unpacker and packer */
+    return FALSE;
+}
 
-    ptype_in = get_host_pixel_type (scale_ctx->pixel_type_in);
-    ptype_out = get_host_pixel_type (scale_ctx->pixel_type_out);
+static void
+init_dispatch (SmolDispatch *dispatch, SmolSelection selection)
+{
+    int storage, filter;
+    int i = 0;
+
+    /* Enumerate implementations, preferred first. The generic implementation
+     * is always last, since it's the only complete one. */
+
+#ifdef SMOL_WITH_AVX2
+    if (selection != SMOL_SELECT_GENERIC && have_avx2 ())
+        dispatch->implementations [i++] = _smol_get_avx2_implementation ();
+#else
+    SMOL_UNUSED (selection);
+#endif
+    dispatch->implementations [i++] = _smol_get_generic_implementation ();
+    dispatch->implementations [i] = NULL;
+
+    /* Pick filters */
+
+    for (storage = 0; storage < SMOL_STORAGE_MAX; storage++)
+    {
+        for (filter = 0; filter < SMOL_FILTER_MAX; filter++)
+        {
+            for (i = 0; dispatch->implementations [i]; i++)
+            {
+                const SmolImplementation *impl = dispatch->implementations [i];
+
+                if (!dispatch->hfilter_impls [storage] [filter]
+                    && impl->hfilter_funcs [storage] [filter])
+                    dispatch->hfilter_impls [storage] [filter] = impl;
+
+                if (!dispatch->vfilter_impls [storage] [filter]
+                    && impl->vfilter_funcs [storage] [filter])
+                    dispatch->vfilter_impls [storage] [filter] = impl;
+            }
+        }
+    }
+}
+
+/* Returns SMOL_SELECT_MAX if the name is unknown or unavailable */
+static SmolSelection
+lookup_selection (const char *name)
+{
+    int selection;
+
+    if (!name)
+        return SMOL_SELECT_AUTO;
+
+    for (selection = 0; selection < SMOL_SELECT_MAX; selection++)
+    {
+        if (!strcmp (name, selection_names [selection]))
+            break;
+    }
+
+    if (selection == SMOL_SELECT_MAX || !selection_is_available (selection))
+        return SMOL_SELECT_MAX;
+
+    return selection;
+}
+
+static SmolSelection
+get_selection (void)
+{
+    int selection = __atomic_load_n (&global_selection, __ATOMIC_ACQUIRE);
+    int unset = -1;
+
+    if (selection >= 0)
+        return selection;
+
+    /* Bad values are ignored, since there's no good way to report them */
+    selection = lookup_selection (getenv ("SMOLSCALE_IMPL"));
+    if (selection == SMOL_SELECT_MAX)
+        selection = SMOL_SELECT_AUTO;
+
+    /* An explicit selection made in the meantime takes precedence */
+    if (!__atomic_compare_exchange_n (&global_selection, &unset, selection,
+                                      FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        selection = unset;
+
+    return selection;
+}
+
+/* Safe to call from multiple threads */
+static SmolDispatch *
+get_dispatch (void)
+{
+    SmolSelection selection = get_selection ();
+    SmolDispatch *dispatch = &global_dispatch [selection];
+    int *dispatch_state = &global_dispatch_state [selection];
+    int state = SMOL_INIT_STATE_NONE;
+
+    if (__atomic_load_n (dispatch_state, __ATOMIC_ACQUIRE) == SMOL_INIT_STATE_DONE)
+        return dispatch;
+
+    if (__atomic_compare_exchange_n (dispatch_state, &state, SMOL_INIT_STATE_BUSY,
+                                     FALSE, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        init_dispatch (dispatch, selection);
+        __atomic_store_n (dispatch_state, SMOL_INIT_STATE_DONE, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        /* Another thread is initializing. It won't take long. */
+        while (__atomic_load_n (dispatch_state, __ATOMIC_ACQUIRE) != SMOL_INIT_STATE_DONE)
+            ;
+    }
+
+    return dispatch;
+}
+
+/* Returns a packer that does the same as the one with the given signature,
+ * but writes with non-temporal stores, or NULL if there is none */
+static SmolRepackRowFunc *
+find_stream_repack (const SmolImplementation **implementations, uint16_t sig)
+{
+    const SmolRepackMeta *meta;
+    int i;
+
+    for (i = 0; implementations [i]; i++)
+    {
+        if (!implementations [i]->repack_stream_meta)
+            continue;
+
+        meta = find_repack_match (implementations [i]->repack_stream_meta, sig, 0xffff);
+        if (meta)
+            return meta->repack_row_func;
+    }
+
+    return NULL;
+}
+
+/* Takes host pixel types */
+static void
+get_repacks (SmolDispatch *dispatch,
+             SmolPixelType ptype_in,
+             SmolPixelType ptype_out,
+             SmolStorageType storage_type,
+             SmolGammaType gamma_type,
+             SmolRepackRowFunc **unpack_row_func_out,
+             SmolRepackRowFunc **pack_row_func_out,
+             SmolRepackRowFunc **pack_row_stream_func_out)
+{
+    SmolRepackCacheEntry *entry = &dispatch->repacks [ptype_in] [ptype_out] [storage_type] [gamma_type];
+    const SmolPixelTypeMeta *pmeta_in, *pmeta_out;
+    const SmolRepackMeta *rmeta_in, *rmeta_out;
+    SmolAlphaType internal_alpha = SMOL_ALPHA_PREMUL8;
+    int state = SMOL_INIT_STATE_NONE;
+
+    if (__atomic_load_n (&entry->state, __ATOMIC_ACQUIRE) == SMOL_INIT_STATE_DONE)
+    {
+        *unpack_row_func_out = entry->unpack_row_func;
+        *pack_row_func_out = entry->pack_row_func;
+        *pack_row_stream_func_out = entry->pack_row_stream_func;
+        return;
+    }
 
     pmeta_in = &pixel_type_meta [ptype_in];
     pmeta_out = &pixel_type_meta [ptype_out];
 
     if (pmeta_in->alpha == SMOL_ALPHA_UNASSOCIATED
         && pmeta_out->alpha == SMOL_ALPHA_UNASSOCIATED)
+        internal_alpha = SMOL_ALPHA_PREMUL16;
+
+    find_repacks (dispatch->implementations,
+                  pmeta_in->storage, storage_type, pmeta_out->storage,
+                  pmeta_in->alpha, internal_alpha, pmeta_out->alpha,
+                  SMOL_GAMMA_SRGB_COMPRESSED, gamma_type, SMOL_GAMMA_SRGB_COMPRESSED,
+                  pmeta_in, pmeta_out,
+                  &rmeta_in, &rmeta_out);
+
+    if (!rmeta_in || !rmeta_out)
+        abort ();
+
+    *unpack_row_func_out = rmeta_in->repack_row_func;
+    *pack_row_func_out = rmeta_out->repack_row_func;
+    *pack_row_stream_func_out = find_stream_repack (dispatch->implementations,
+                                                    rmeta_out->signature);
+
+    /* If another thread is already filling in this entry, leave it be; we'll
+     * have arrived at the same result. */
+    if (__atomic_compare_exchange_n (&entry->state, &state, SMOL_INIT_STATE_BUSY,
+                                     FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        entry->unpack_row_func = rmeta_in->repack_row_func;
+        entry->pack_row_func = rmeta_out->repack_row_func;
+        entry->pack_row_stream_func = *pack_row_stream_func_out;
+        __atomic_store_n (&entry->state, SMOL_INIT_STATE_DONE, __ATOMIC_RELEASE);
+    }
+}
+
+/* scale_ctx->storage_type must be initialized first by pick_filter_params() */
+static void
+get_implementations (SmolScaleCtx *scale_ctx)
+{
+    SmolDispatch *dispatch = get_dispatch ();
+    SmolPixelType ptype_in, ptype_out;
+    const SmolImplementation *impl;
+
+    /* Install unpacker and packer */
+
+    ptype_in = get_host_pixel_type (scale_ctx->pixel_type_in);
+    ptype_out = get_host_pixel_type (scale_ctx->pixel_type_out);
+
+    if (pixel_type_meta [ptype_in].alpha == SMOL_ALPHA_UNASSOCIATED
+        && pixel_type_meta [ptype_out].alpha == SMOL_ALPHA_UNASSOCIATED)
     {
         /* In order to preserve the color range in transparent pixels when going
          * from unassociated to unassociated, we use 16 bits per channel internally. */
-        internal_alpha = SMOL_ALPHA_PREMUL16;
         scale_ctx->storage_type = SMOL_STORAGE_128BPP;
     }
 
@@ -769,50 +1700,85 @@ get_implementations (SmolScaleCtx *scale_ctx)
         scale_ctx->gamma_type = SMOL_GAMMA_SRGB_COMPRESSED;
     }
 
-    find_repacks (implementations,
-                  pmeta_in->storage, scale_ctx->storage_type, pmeta_out->storage,
-                  pmeta_in->alpha, internal_alpha, pmeta_out->alpha,
-                  SMOL_GAMMA_SRGB_COMPRESSED, scale_ctx->gamma_type, SMOL_GAMMA_SRGB_COMPRESSED,
-                  pmeta_in, pmeta_out,
-                  &rmeta_in, &rmeta_out);
+    get_repacks (dispatch, ptype_in, ptype_out,
+                 scale_ctx->storage_type, scale_ctx->gamma_type,
+                 &scale_ctx->unpack_row_func, &scale_ctx->pack_row_func,
+                 &scale_ctx->pack_row_stream_func);
 
-    if (!rmeta_in || !rmeta_out)
+    /* Install filters */
+
+    impl = dispatch->hfilter_impls [scale_ctx->storage_type] [scale_ctx->filter_h];
+    if (!impl)
         abort ();
 
-    scale_ctx->unpack_row_func = rmeta_in->repack_row_func;
-    scale_ctx->pack_row_func = rmeta_out->repack_row_func;
+    scale_ctx->hfilter_func = impl->hfilter_funcs [scale_ctx->storage_type] [scale_ctx->filter_h];
+    scale_ctx->impl_h = impl;
+    if (impl->init_h_func)
+        impl->init_h_func (scale_ctx);
 
-    /* Install filters */
+    impl = dispatch->vfilter_impls [scale_ctx->storage_type] [scale_ctx->filter_v];
+    if (!impl)
+        abort ();
 
-    scale_ctx->hfilter_func = NULL;
-    scale_ctx->vfilter_func = NULL;
+    scale_ctx->vfilter_func = impl->vfilter_funcs [scale_ctx->storage_type] [scale_ctx->filter_v];
+    scale_ctx->impl_v = impl;
+    if (impl->init_v_func)
+        impl->init_v_func (scale_ctx);
+}
 
-    for (i = 0; implementations [i]; i++)
-    {
-        SmolHFilterFunc *hfilter_func =
-            implementations [i]->hfilter_funcs [scale_ctx->storage_type] [scale_ctx->filter_h];
-        SmolVFilterFunc *vfilter_func =
-            implementations [i]->vfilter_funcs [scale_ctx->storage_type] [scale_ctx->filter_v];
+/* The vertical-first context or the per-strip copy of precalc_x, if either
+ * is needed, is stored after the precalc arrays */
+static size_t
+get_precalc_size (uint32_t width_bilin_out,
+                  uint32_t height_bilin_out,
+                  uint8_t vertical_first,
+                  uint8_t strip_precalc)
+{
+    size_t size = ((width_bilin_out + 1) * 2 + (height_bilin_out + 1) * 2) * sizeof (uint16_t);
 
-        if (!scale_ctx->hfilter_func && hfilter_func)
-        {
-            scale_ctx->hfilter_func = hfilter_func;
-            if (implementations [i]->init_h_func)
-                implementations [i]->init_h_func (scale_ctx);
-        }
+    if (vertical_first)
+        size = SMOL_ALIGN_UP (size, (size_t) SMOL_ALIGNMENT) + sizeof (SmolScaleCtx);
+    else if (strip_precalc)
+        size = SMOL_ALIGN_UP (size, (size_t) SMOL_ALIGNMENT)
+            + (width_bilin_out + 1) * 2 * sizeof (uint16_t);
 
-        if (!scale_ctx->vfilter_func && vfilter_func)
-        {
-            scale_ctx->vfilter_func = vfilter_func;
-            if (implementations [i]->init_v_func)
-                implementations [i]->init_v_func (scale_ctx);
-        }
-    }
+    return size;
+}
+
+/* Sets up the context the vertical filter runs with when going vertical-first.
+ * It's a copy that keeps the input width and leaves its output as parts.
+ * The implementations must have been installed in scale_ctx. */
+static void
+init_vertical_first (SmolScaleCtx *scale_ctx,
+                     SmolScaleCtx *vfirst_ctx)
+{
+    SmolDispatch *dispatch = get_dispatch ();
+    const SmolImplementation *impl;
+
+    *vfirst_ctx = *scale_ctx;
 
-    if (!scale_ctx->hfilter_func || !scale_ctx->vfilter_func)
+    vfirst_ctx->width_out = scale_ctx->width_in;
+    vfirst_ctx->filter_h = SMOL_FILTER_COPY;
+    vfirst_ctx->post_row_func = NULL;
+    vfirst_ctx->user_data = NULL;
+    vfirst_ctx->precalc_x_storage = NULL;
+
+    impl = dispatch->hfilter_impls [scale_ctx->storage_type] [SMOL_FILTER_COPY];
+    if (!impl)
         abort ();
+
+    vfirst_ctx->hfilter_func = impl->hfilter_funcs [scale_ctx->storage_type] [SMOL_FILTER_COPY];
+    vfirst_ctx->impl_h = impl;
+    vfirst_ctx->pack_row_func = scale_ctx->storage_type == SMOL_STORAGE_128BPP
+        ? copy_parts_128bpp : copy_parts_64bpp;
+
+    scale_ctx->vfirst_ctx = vfirst_ctx;
 }
 
+/* If precalc_storage is NULL, precalc arrays will be allocated, and must be freed
+ * with smol_scale_finalize(). Otherwise it must be SMOL_ALIGNMENT-aligned and
+ * hold at least get_precalc_size() bytes. If allocator is NULL, the global one
+ * is used. */
 static void
 smol_scale_init (SmolScaleCtx *scale_ctx,
                  const void *pixels_in,
@@ -827,9 +1793,13 @@ smol_scale_init (SmolScaleCtx *scale_ctx,
                  uint32_t rowstride_out,
                  uint8_t with_srgb,
                  SmolPostRowFunc post_row_func,
-                 void *user_data)
+                 void *user_data,
+                 const SmolAllocator *allocator,
+                 void *precalc_storage)
 {
     SmolStorageType storage_type [2];
+    uint8_t vertical_first, strip_precalc;
+    char *extra_storage;
 
     scale_ctx->pixels_in = pixels_in;
     scale_ctx->pixel_type_in = pixel_type_in;
@@ -845,6 +1815,11 @@ smol_scale_init (SmolScaleCtx *scale_ctx,
 
     scale_ctx->post_row_func = post_row_func;
     scale_ctx->user_data = user_data;
+    scale_ctx->allocator = allocator ? *allocator : global_allocator;
+
+#ifdef SMOL_WITH_STATS
+    memset (&scale_ctx->stats, 0, sizeof (scale_ctx->stats));
+#endif
 
     pick_filter_params (width_in, width_out,
                         &scale_ctx->width_halvings,
@@ -861,18 +1836,84 @@ smol_scale_init (SmolScaleCtx *scale_ctx,
 
     scale_ctx->storage_type = MAX (storage_type [0], storage_type [1]);
 
-    scale_ctx->precalc_x = smol_alloc_aligned (((scale_ctx->width_bilin_out + 1) * 2
-                                                + (scale_ctx->height_bilin_out + 1) * 2) * sizeof (uint16_t),
-                                               &scale_ctx->precalc_x_storage);
+    vertical_first = pick_vertical_first (width_in, width_out,
+                                          height_in, height_out,
+                                          scale_ctx->height_bilin_out,
+                                          scale_ctx->filter_h,
+                                          scale_ctx->filter_v);
+    strip_precalc = want_strip_precalc (width_in, width_out,
+                                        scale_ctx->filter_h, scale_ctx->filter_v,
+                                        vertical_first);
+
+    if (precalc_storage)
+    {
+        scale_ctx->precalc_x = precalc_storage;
+        scale_ctx->precalc_x_storage = NULL;
+    }
+    else
+    {
+        scale_ctx->precalc_x = smol_alloc_aligned (&scale_ctx->allocator,
+                                                   get_precalc_size (scale_ctx->width_bilin_out,
+                                                                     scale_ctx->height_bilin_out,
+                                                                     vertical_first,
+                                                                     strip_precalc),
+                                                   &scale_ctx->precalc_x_storage);
+    }
+
     scale_ctx->precalc_y = scale_ctx->precalc_x + (scale_ctx->width_bilin_out + 1) * 2;
+    scale_ctx->vfirst_ctx = NULL;
+    scale_ctx->precalc_x_is_absolute = FALSE;
+    scale_ctx->precalc_x_strips = NULL;
+    scale_ctx->unpack_ofs = 0;
+    scale_ctx->hfilter_ofs = 0;
 
     get_implementations (scale_ctx);
+
+    extra_storage = (char *) scale_ctx->precalc_x
+        + SMOL_ALIGN_UP (get_precalc_size (scale_ctx->width_bilin_out,
+                                           scale_ctx->height_bilin_out,
+                                           FALSE, FALSE),
+                         (size_t) SMOL_ALIGNMENT);
+
+    if (vertical_first)
+        init_vertical_first (scale_ctx, (SmolScaleCtx *) extra_storage);
+
+    scale_ctx->strip_width_out = pick_strip_width (scale_ctx);
+    if (scale_ctx->strip_width_out)
+        init_strip_precalc (scale_ctx, (uint16_t *) extra_storage);
 }
 
 static void
 smol_scale_finalize (SmolScaleCtx *scale_ctx)
 {
-    free (scale_ctx->precalc_x_storage);
+    if (scale_ctx->precalc_x_storage)
+        smol_free (&scale_ctx->allocator, scale_ctx->precalc_x_storage);
+}
+
+/* Jobs that compare equal can share a context */
+static int
+compare_jobs (const void *a, const void *b)
+{
+    const SmolScaleJob *job_a = *((const SmolScaleJob * const *) a);
+    const SmolScaleJob *job_b = *((const SmolScaleJob * const *) b);
+
+#define COMPARE_FIELD(f) \
+    if (job_a->f != job_b->f) \
+        return job_a->f < job_b->f ? -1 : 1;
+
+    COMPARE_FIELD (pixel_type_in);
+    COMPARE_FIELD (pixel_type_out);
+    COMPARE_FIELD (width_in);
+    COMPARE_FIELD (height_in);
+    COMPARE_FIELD (width_out);
+    COMPARE_FIELD (height_out);
+
+#undef COMPARE_FIELD
+
+    if (!job_a->with_srgb != !job_b->with_srgb)
+        return job_a->with_srgb ? 1 : -1;
+
+    return 0;
 }
 
 /* ---------- *
@@ -892,24 +1933,20 @@ smol_scale_new (const void *pixels_in,
                 uint32_t rowstride_out,
                 uint8_t with_srgb)
 {
-    SmolScaleCtx *scale_ctx;
-
-    scale_ctx = calloc (sizeof (SmolScaleCtx), 1);
-    smol_scale_init (scale_ctx,
-                     pixels_in,
-                     pixel_type_in,
-                     width_in,
-                     height_in,
-                     rowstride_in,
-                     pixels_out,
-                     pixel_type_out,
-                     width_out,
-                     height_out,
-                     rowstride_out,
-                     with_srgb,
-                     NULL,
-                     NULL);
-    return scale_ctx;
+    return smol_scale_new_with_allocator (pixels_in,
+                                          pixel_type_in,
+                                          width_in,
+                                          height_in,
+                                          rowstride_in,
+                                          pixels_out,
+                                          pixel_type_out,
+                                          width_out,
+                                          height_out,
+                                          rowstride_out,
+                                          with_srgb,
+                                          NULL,
+                                          NULL,
+                                          NULL);
 }
 
 SmolScaleCtx *
@@ -926,10 +1963,47 @@ smol_scale_new_full (const void *pixels_in,
                      uint8_t with_srgb,
                      SmolPostRowFunc post_row_func,
                      void *user_data)
+{
+    return smol_scale_new_with_allocator (pixels_in,
+                                          pixel_type_in,
+                                          width_in,
+                                          height_in,
+                                          rowstride_in,
+                                          pixels_out,
+                                          pixel_type_out,
+                                          width_out,
+                                          height_out,
+                                          rowstride_out,
+                                          with_srgb,
+                                          post_row_func,
+                                          user_data,
+                                          NULL);
+}
+
+SmolScaleCtx *
+smol_scale_new_with_allocator (const void *pixels_in,
+                               SmolPixelType pixel_type_in,
+                               uint32_t width_in,
+                               uint32_t height_in,
+                               uint32_t rowstride_in,
+                               void *pixels_out,
+                               SmolPixelType pixel_type_out,
+                               uint32_t width_out,
+                               uint32_t height_out,
+                               uint32_t rowstride_out,
+                               uint8_t with_srgb,
+                               SmolPostRowFunc post_row_func,
+                               void *user_data,
+                               const SmolAllocator *allocator)
 {
     SmolScaleCtx *scale_ctx;
 
-    scale_ctx = calloc (sizeof (SmolScaleCtx), 1);
+    if (!allocator)
+        allocator = &global_allocator;
+
+    scale_ctx = smol_alloc (allocator, sizeof (SmolScaleCtx));
+    memset (scale_ctx, 0, sizeof (SmolScaleCtx));
+
     smol_scale_init (scale_ctx,
                      pixels_in,
                      pixel_type_in,
@@ -943,15 +2017,90 @@ smol_scale_new_full (const void *pixels_in,
                      rowstride_out,
                      with_srgb,
                      post_row_func,
-                     user_data);
+                     user_data,
+                     allocator,
+                     NULL);
     return scale_ctx;
 }
 
 void
 smol_scale_destroy (SmolScaleCtx *scale_ctx)
 {
+    /* The context holds the allocator, so take it out first */
+    SmolAllocator allocator = scale_ctx->allocator;
+
     smol_scale_finalize (scale_ctx);
-    free (scale_ctx);
+    smol_free (&allocator, scale_ctx);
+}
+
+size_t
+smol_scale_ctx_size (uint32_t width_in,
+                     uint32_t height_in,
+                     uint32_t width_out,
+                     uint32_t height_out)
+{
+    uint32_t halvings, width_bilin_out, height_bilin_out;
+    SmolFilterType filter_h, filter_v;
+    SmolStorageType storage_type;
+    uint8_t vertical_first;
+
+    /* The sRGB setting doesn't affect the dimensions or the pass order */
+    pick_filter_params (width_in, width_out,
+                        &halvings, &width_bilin_out, &filter_h, &storage_type, FALSE);
+    pick_filter_params (height_in, height_out,
+                        &halvings, &height_bilin_out, &filter_v, &storage_type, FALSE);
+    vertical_first = pick_vertical_first (width_in, width_out, height_in, height_out,
+                                          height_bilin_out, filter_h, filter_v);
+
+    return SMOL_ALIGNMENT - 1
+        + SMOL_ALIGN_UP (sizeof (SmolScaleCtx), (size_t) SMOL_ALIGNMENT)
+        + get_precalc_size (width_bilin_out, height_bilin_out, vertical_first,
+                            want_strip_precalc (width_in, width_out, filter_h, filter_v,
+                                                vertical_first));
+}
+
+SmolScaleCtx *
+smol_scale_init_in_storage (void *storage,
+                            size_t storage_size,
+                            const void *pixels_in,
+                            SmolPixelType pixel_type_in,
+                            uint32_t width_in,
+                            uint32_t height_in,
+                            uint32_t rowstride_in,
+                            void *pixels_out,
+                            SmolPixelType pixel_type_out,
+                            uint32_t width_out,
+                            uint32_t height_out,
+                            uint32_t rowstride_out,
+                            uint8_t with_srgb,
+                            SmolPostRowFunc post_row_func,
+                            void *user_data)
+{
+    SmolScaleCtx *scale_ctx;
+
+    if (storage_size < smol_scale_ctx_size (width_in, height_in, width_out, height_out))
+        return NULL;
+
+    scale_ctx = (SmolScaleCtx *) SMOL_ALIGN_UP ((uintptr_t) storage, SMOL_ALIGNMENT);
+    memset (scale_ctx, 0, sizeof (SmolScaleCtx));
+
+    smol_scale_init (scale_ctx,
+                     pixels_in,
+                     pixel_type_in,
+                     width_in,
+                     height_in,
+                     rowstride_in,
+                     pixels_out,
+                     pixel_type_out,
+                     width_out,
+                     height_out,
+                     rowstride_out,
+                     with_srgb,
+                     post_row_func,
+                     user_data,
+                     NULL,
+                     (char *) scale_ctx + SMOL_ALIGN_UP (sizeof (SmolScaleCtx), (size_t) SMOL_ALIGNMENT));
+    return scale_ctx;
 }
 
 void
@@ -976,11 +2125,13 @@ smol_scale_simple (const void *pixels_in,
                      pixels_out, pixel_type_out,
                      width_out, height_out, rowstride_out,
                      with_srgb,
-                     NULL, NULL);
+                     NULL, NULL, NULL, NULL);
     do_rows (&scale_ctx,
+             NULL,
              outrow_ofs_to_pointer (&scale_ctx, 0),
              0,
-             scale_ctx.height_out);
+             scale_ctx.height_out,
+             NULL, NULL);
     smol_scale_finalize (&scale_ctx);
 }
 
@@ -990,9 +2141,11 @@ smol_scale_batch (const SmolScaleCtx *scale_ctx,
                   uint32_t n_out_rows)
 {
     do_rows (scale_ctx,
+             NULL,
              outrow_ofs_to_pointer (scale_ctx, first_out_row),
              first_out_row,
-             n_out_rows);
+             n_out_rows,
+             NULL, NULL);
 }
 
 void
@@ -1002,7 +2155,194 @@ smol_scale_batch_full (const SmolScaleCtx *scale_ctx,
                        uint32_t n_out_rows)
 {
     do_rows (scale_ctx,
+             NULL,
              outrows_dest,
              first_out_row,
-             n_out_rows);
+             n_out_rows,
+             NULL, NULL);
+}
+
+size_t
+smol_scale_get_scratch_size (const SmolScaleCtx *scale_ctx)
+{
+    return get_scratch_size (scale_ctx);
+}
+
+void
+smol_scale_batch_with_scratch (const SmolScaleCtx *scale_ctx,
+                               void *scratch,
+                               void *outrows_dest,
+                               uint32_t first_out_row,
+                               uint32_t n_out_rows)
+{
+    if (!outrows_dest)
+        outrows_dest = outrow_ofs_to_pointer (scale_ctx, first_out_row);
+
+    do_rows (scale_ctx,
+             scratch,
+             outrows_dest,
+             first_out_row,
+             n_out_rows,
+             NULL, NULL);
+}
+
+void
+smol_scale_batch_to_sink (const SmolScaleCtx *scale_ctx,
+                          void *scratch,
+                          uint32_t first_out_row,
+                          uint32_t n_out_rows,
+                          SmolRowSinkFunc *row_sink_func,
+                          void *user_data)
+{
+    do_rows (scale_ctx,
+             scratch,
+             NULL,
+             first_out_row,
+             n_out_rows,
+             row_sink_func,
+             user_data);
+}
+
+void
+smol_scale_get_info (const SmolScaleCtx *scale_ctx,
+                     SmolScaleInfo *info_out)
+{
+    info_out->filter_h = filter_names [scale_ctx->filter_h];
+    info_out->filter_v = filter_names [scale_ctx->filter_v];
+    info_out->width_halvings = scale_ctx->filter_h >= SMOL_FILTER_BILINEAR_0H
+        && scale_ctx->filter_h <= SMOL_FILTER_BILINEAR_6H ? scale_ctx->width_halvings : 0;
+    info_out->height_halvings = scale_ctx->filter_v >= SMOL_FILTER_BILINEAR_0H
+        && scale_ctx->filter_v <= SMOL_FILTER_BILINEAR_6H ? scale_ctx->height_halvings : 0;
+    info_out->storage_bpp = scale_ctx->storage_type == SMOL_STORAGE_128BPP ? 128 : 64;
+    info_out->with_srgb = scale_ctx->gamma_type == SMOL_GAMMA_SRGB_LINEAR ? 1 : 0;
+    info_out->vertical_first = scale_ctx->vfirst_ctx ? 1 : 0;
+    info_out->strip_width = scale_ctx->strip_width_out;
+    info_out->stream_output = want_stream_output (scale_ctx) ? 1 : 0;
+    info_out->implementation_h = scale_ctx->impl_h->name;
+    info_out->implementation_v = scale_ctx->impl_v->name;
+}
+
+int
+smol_scale_get_stats (const SmolScaleCtx *scale_ctx,
+                      SmolScaleStats *stats_out)
+{
+#ifdef SMOL_WITH_STATS
+    uint32_t i;
+
+    for (i = 0; i < SMOL_STAGE_MAX; i++)
+    {
+        stats_out->ticks [i] = __atomic_load_n (&scale_ctx->stats.ticks [i], __ATOMIC_RELAXED);
+        stats_out->n_calls [i] = __atomic_load_n (&scale_ctx->stats.n_calls [i], __ATOMIC_RELAXED);
+    }
+
+    return 1;
+#else
+    SMOL_UNUSED (scale_ctx);
+    memset (stats_out, 0, sizeof (*stats_out));
+    return 0;
+#endif
+}
+
+void
+smol_scale_reset_stats (SmolScaleCtx *scale_ctx)
+{
+#ifdef SMOL_WITH_STATS
+    memset (&scale_ctx->stats, 0, sizeof (scale_ctx->stats));
+#else
+    SMOL_UNUSED (scale_ctx);
+#endif
+}
+
+void
+smol_scale_many (const SmolScaleJob *jobs,
+                 uint32_t n_jobs)
+{
+    SmolAllocator allocator = global_allocator;
+    const SmolScaleJob **sorted_jobs;
+    uint32_t i, j;
+
+    if (n_jobs == 0)
+        return;
+
+    /* Group jobs with identical geometry, so they can share precalc and
+     * row storage. */
+
+    sorted_jobs = smol_alloc (&allocator, n_jobs * sizeof (SmolScaleJob *));
+    for (i = 0; i < n_jobs; i++)
+        sorted_jobs [i] = &jobs [i];
+
+    qsort (sorted_jobs, n_jobs, sizeof (SmolScaleJob *), compare_jobs);
+
+    for (i = 0; i < n_jobs; i = j)
+    {
+        const SmolScaleJob *job = sorted_jobs [i];
+        SmolScaleCtx scale_ctx;
+        SmolVerticalCtx vertical_ctx;
+
+        smol_scale_init (&scale_ctx,
+                         job->pixels_in, job->pixel_type_in,
+                         job->width_in, job->height_in, job->rowstride_in,
+                         job->pixels_out, job->pixel_type_out,
+                         job->width_out, job->height_out, job->rowstride_out,
+                         job->with_srgb,
+                         NULL, NULL, &allocator, NULL);
+        init_vertical_ctx (&scale_ctx, &vertical_ctx, NULL);
+
+        for (j = i; j < n_jobs && !compare_jobs (&sorted_jobs [i], &sorted_jobs [j]); j++)
+        {
+            job = sorted_jobs [j];
+
+            scale_ctx.pixels_in = job->pixels_in;
+            scale_ctx.rowstride_in = job->rowstride_in;
+            scale_ctx.pixels_out = job->pixels_out;
+            scale_ctx.rowstride_out = job->rowstride_out;
+
+            if (scale_ctx.vfirst_ctx)
+            {
+                scale_ctx.vfirst_ctx->pixels_in = job->pixels_in;
+                scale_ctx.vfirst_ctx->rowstride_in = job->rowstride_in;
+            }
+
+            /* Cached rows belong to the previous image */
+            vertical_ctx.in_ofs = UINT_MAX - 1;
+
+            scale_rows_auto (&scale_ctx, &vertical_ctx,
+                             outrow_ofs_to_pointer (&scale_ctx, 0),
+                             0,
+                             scale_ctx.height_out,
+                             NULL, NULL);
+        }
+
+        finalize_vertical_ctx (&scale_ctx, &vertical_ctx);
+        smol_scale_finalize (&scale_ctx);
+    }
+
+    smol_free (&allocator, sorted_jobs);
+}
+
+void
+smol_set_allocator (const SmolAllocator *allocator)
+{
+    global_allocator = allocator ? *allocator : default_allocator;
+}
+
+int
+smol_set_implementation (const char *name)
+{
+    SmolSelection selection = lookup_selection (name);
+
+    if (selection == SMOL_SELECT_MAX)
+        return 0;
+
+    __atomic_store_n (&global_selection, selection, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void
+smol_set_pass_order (SmolPassOrder order)
+{
+    if (order >= SMOL_PASS_ORDER_MAX)
+        order = SMOL_PASS_ORDER_AUTO;
+
+    __atomic_store_n (&global_pass_order, order, __ATOMIC_RELEASE);
 }
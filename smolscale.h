@@ -2,6 +2,7 @@
 
 /* Copyright © 2019-2023 Hans Petter Jansson. See COPYING for details. */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef _SMOLSCALE_H_
@@ -38,11 +39,52 @@ typedef void (SmolPostRowFunc) (uint32_t *row_inout,
                                 int width,
                                 void *user_data);
 
+typedef void (SmolRowSinkFunc) (const void *row_out,
+                                uint32_t outrow_index,
+                                uint32_t width,
+                                void *user_data);
+
+typedef void *(SmolAllocFunc) (size_t size,
+                               void *user_data);
+
+typedef void (SmolFreeFunc) (void *p,
+                             void *user_data);
+
+typedef void *(SmolAlignedAllocFunc) (size_t size,
+                                      size_t alignment,
+                                      void *user_data);
+
+typedef struct
+{
+    SmolAllocFunc *alloc_func;
+    SmolFreeFunc *free_func;
+    SmolAlignedAllocFunc *aligned_alloc_func;
+    void *user_data;
+}
+SmolAllocator;
+
 typedef struct SmolScaleCtx SmolScaleCtx;
 
+typedef struct
+{
+    const void *pixels_in;
+    SmolPixelType pixel_type_in;
+    uint32_t width_in, height_in, rowstride_in;
+
+    void *pixels_out;
+    SmolPixelType pixel_type_out;
+    uint32_t width_out, height_out, rowstride_out;
+
+    uint8_t with_srgb;
+}
+SmolScaleJob;
+
 /* Simple API: Scales an entire image in one shot. You must provide pointers to
  * the source memory and an existing allocation to receive the output data.
- * This interface can only be used from a single thread. */
+ * This interface can only be used from a single thread.
+ *
+ * Input rows may have any alignment. For 32-bit output pixel types, pixels_out
+ * and rowstride_out must be multiples of 4. */
 
 void smol_scale_simple (const void *pixels_in, SmolPixelType pixel_type_in,
                         uint32_t width_in, uint32_t height_in, uint32_t rowstride_in,
@@ -50,6 +92,14 @@ void smol_scale_simple (const void *pixels_in, SmolPixelType pixel_type_in,
                         uint32_t width_out, uint32_t height_out, uint32_t rowstride_out,
                         uint8_t with_srgb);
 
+/* In-place scaling: pixels_out may be equal to pixels_in, provided that
+ * height_out <= height_in and rowstride_out <= rowstride_in. If the height is
+ * unchanged, rowstride_out may also be larger than rowstride_in, in which
+ * case the rows are processed bottom-up; make sure the input allocation can
+ * hold the output. In either case, rows must be scaled in order from a single
+ * thread, e.g. with smol_scale_simple() or one call to smol_scale_batch()
+ * for all rows. */
+
 /* Batch API: Allows scaling a few rows at a time. Suitable for multithreading. */
 
 SmolScaleCtx *smol_scale_new (const void *pixels_in, SmolPixelType pixel_type_in,
@@ -81,6 +131,186 @@ void smol_scale_batch_full (const SmolScaleCtx *scale_ctx,
                             void *outrows_dest,
                             uint32_t first_outrow, uint32_t n_outrows);
 
+/* Allocation-free API: Like smol_scale_new_full(), but places the context in
+ * caller-provided storage of at least smol_scale_ctx_size() bytes. Returns
+ * NULL if storage_size is too small. Don't call smol_scale_destroy() on the
+ * result; just release the storage when you're done with it.
+ *
+ * The regular batch functions allocate scratch memory for each call. To avoid
+ * that, use smol_scale_batch_with_scratch() with a buffer of at least
+ * smol_scale_get_scratch_size() bytes. Concurrent batches must use separate
+ * scratch buffers. If outrows_dest is NULL, rows are written relative to
+ * pixels_out. */
+
+size_t smol_scale_ctx_size (uint32_t width_in, uint32_t height_in,
+                            uint32_t width_out, uint32_t height_out);
+
+SmolScaleCtx *smol_scale_init_in_storage (void *storage, size_t storage_size,
+                                          const void *pixels_in, SmolPixelType pixel_type_in,
+                                          uint32_t width_in, uint32_t height_in, uint32_t rowstride_in,
+                                          void *pixels_out, SmolPixelType pixel_type_out,
+                                          uint32_t width_out, uint32_t height_out, uint32_t rowstride_out,
+                                          uint8_t with_srgb,
+                                          SmolPostRowFunc post_row_func, void *user_data);
+
+size_t smol_scale_get_scratch_size (const SmolScaleCtx *scale_ctx);
+
+void smol_scale_batch_with_scratch (const SmolScaleCtx *scale_ctx,
+                                    void *scratch,
+                                    void *outrows_dest,
+                                    uint32_t first_outrow, uint32_t n_outrows);
+
+/* Streaming API: Like smol_scale_batch(), but instead of being written to
+ * memory, each output row is packed into an internal buffer and passed to
+ * row_sink_func. The buffer is only valid for the duration of the call. The
+ * post-row function, if any, is applied first. pixels_out is not used and
+ * may be NULL. scratch may be NULL, or point to a buffer as described for
+ * smol_scale_batch_with_scratch(). */
+
+void smol_scale_batch_to_sink (const SmolScaleCtx *scale_ctx,
+                               void *scratch,
+                               uint32_t first_outrow, uint32_t n_outrows,
+                               SmolRowSinkFunc *row_sink_func, void *user_data);
+
+/* Introspection: Describes the plan chosen for a context. Filter names are
+ * "copy", "one", "bilinear-<n>h" (bilinear with n halvings) or "box".
+ * Storage is the internal bits per pixel, 64 or 128. with_srgb is 0 if
+ * linearization was not requested, or was turned off because the input
+ * is more than 8191 times larger than the output. vertical_first is 1 if
+ * rows are filtered vertically before horizontally, which is picked when
+ * it touches fewer pixels. strip_width is the width of the column strips
+ * wide images are scaled in, or 0 if they're scaled whole. Strips are not
+ * used with row sinks or in-place scaling. stream_output is 1 if rows
+ * written to pixels_out use non-temporal stores, which is done for big
+ * outputs when there's no post-row function. Rows for sinks or other
+ * buffers are always written through the cache. The implementation names
+ * are "generic" or "avx2". Strings are static. */
+
+typedef struct
+{
+    const char *filter_h, *filter_v;
+    uint32_t width_halvings, height_halvings;
+    uint32_t storage_bpp;
+    uint8_t with_srgb;
+    uint8_t vertical_first;
+    uint32_t strip_width;
+    uint8_t stream_output;
+    const char *implementation_h, *implementation_v;
+}
+SmolScaleInfo;
+
+void smol_scale_get_info (const SmolScaleCtx *scale_ctx, SmolScaleInfo *info_out);
+
+/* Instrumentation: If Smolscale was built with -DSMOL_WITH_STATS, each
+ * context accumulates the time spent in each stage of the pipeline, along
+ * with call counts. Ticks are CPU cycles on x86 and nanoseconds elsewhere.
+ * Vertical filter time excludes the stages it calls into. Stats are added
+ * to the context when a batch completes.
+ *
+ * Without instrumentation, smol_scale_get_stats() clears stats_out and
+ * returns 0. */
+
+typedef enum
+{
+    SMOL_STAGE_UNPACK,
+    SMOL_STAGE_HFILTER,
+    SMOL_STAGE_VFILTER,
+    SMOL_STAGE_PACK,
+    SMOL_STAGE_POST_ROW,
+
+    SMOL_STAGE_MAX
+}
+SmolStage;
+
+typedef struct
+{
+    uint64_t ticks [SMOL_STAGE_MAX];
+    uint64_t n_calls [SMOL_STAGE_MAX];
+}
+SmolScaleStats;
+
+int smol_scale_get_stats (const SmolScaleCtx *scale_ctx, SmolScaleStats *stats_out);
+void smol_scale_reset_stats (SmolScaleCtx *scale_ctx);
+
+/* Many-image API: Scales a list of images in one call. Jobs with identical
+ * dimensions, pixel types and sRGB setting share a single context and its row
+ * storage, which amortizes setup cost when there are many small images.
+ * Column strips and streaming output are still decided per job, as they
+ * would be by smol_scale_simple(). The jobs are processed serially in no
+ * particular order; to spread them over several threads, split the list and
+ * call this once per thread. */
+
+void smol_scale_many (const SmolScaleJob *jobs, uint32_t n_jobs);
+
+/* Memory allocation: All memory Smolscale allocates, including contexts,
+ * precalc and scratch buffers, comes from the global allocator set with
+ * smol_set_allocator(), or the one passed to smol_scale_new_with_allocator()
+ * for that context. The allocator is copied, and a context and its batches
+ * keep using the one it was created with. Passing NULL restores the default
+ * allocator, or for a context, uses the global one. smol_set_allocator()
+ * must not be called while contexts are being created in other threads.
+ *
+ * alloc_func and free_func are required. aligned_alloc_func may be NULL; if
+ * set, it's used for buffers that need alignment, which is a power of two,
+ * and those are released with free_func too. Otherwise such buffers are
+ * over-allocated with alloc_func and aligned internally.
+ *
+ * The default allocator gives buffers of 2 MiB or more their own mapping,
+ * aligned for transparent huge pages, and asks for those where the OS
+ * supports them. The batch functions allocate scratch memory in the calling
+ * thread, which is also where it's first touched, so on NUMA systems it's
+ * placed on the worker's node. Scratch passed to
+ * smol_scale_batch_with_scratch() should likewise be allocated and first
+ * written to by the thread that uses it. For any other placement, such as
+ * a fixed node, pass an allocator that does it. */
+
+void smol_set_allocator (const SmolAllocator *allocator);
+
+SmolScaleCtx *smol_scale_new_with_allocator (const void *pixels_in, SmolPixelType pixel_type_in,
+                                             uint32_t width_in, uint32_t height_in, uint32_t rowstride_in,
+                                             void *pixels_out, SmolPixelType pixel_type_out,
+                                             uint32_t width_out, uint32_t height_out, uint32_t rowstride_out,
+                                             uint8_t with_srgb,
+                                             SmolPostRowFunc post_row_func, void *user_data,
+                                             const SmolAllocator *allocator);
+
+/* Implementation selection: By default, the fastest implementation supported
+ * by the CPU is used, with the generic one filling in for anything it lacks.
+ * smol_set_implementation() makes contexts created afterwards prefer the named
+ * implementation instead: "generic", "avx2", or "auto" (or NULL) to restore
+ * the default. Existing contexts are unaffected. Returns 0 if the name is
+ * unknown or the host can't run it, leaving the selection unchanged.
+ *
+ * The SMOLSCALE_IMPL environment variable, if set, provides the initial
+ * selection. It is read once, before the first context is created. */
+
+int smol_set_implementation (const char *name);
+
+/* Pass order: By default, rows are filtered vertically before horizontally
+ * when that touches fewer pixels; see vertical_first in SmolScaleInfo.
+ * Rounding happens after each pass, so the two orders can give slightly
+ * different output: at most 2 per channel for premultiplied output, or 3
+ * for unassociated output once it's premultiplied. The unassociated colors
+ * themselves are divided by alpha, so at low alpha they can differ more, and
+ * so can RGB output from RGBA input with sRGB.
+ *
+ * smol_set_pass_order() makes contexts created afterwards use one order
+ * where the filters allow it, e.g. for output that's reproducible across
+ * versions, or AUTO to restore the default. Existing contexts are
+ * unaffected. */
+
+typedef enum
+{
+    SMOL_PASS_ORDER_AUTO,
+    SMOL_PASS_ORDER_HORIZONTAL_FIRST,
+    SMOL_PASS_ORDER_VERTICAL_FIRST,
+
+    SMOL_PASS_ORDER_MAX
+}
+SmolPassOrder;
+
+void smol_set_pass_order (SmolPassOrder order);
+
 #ifdef __cplusplus
 }
 #endif
@@ -394,6 +394,181 @@ verify_saturation (void)
     return result;
 }
 
+/* White pixels with alternating alpha, scaled horizontal-first in linear
+ * space. Colors that filter to just above their alpha must saturate to white
+ * when unpremultiplied, not wrap around. */
+static int
+verify_linear_saturation_dims (SmolPixelType type_in,
+                               uint32_t width_in, uint32_t height_in,
+                               uint32_t width_out, uint32_t height_out)
+{
+    unsigned char *input = malloc (width_in * height_in * 4);
+    unsigned char *output = malloc (width_out * height_out * 4);
+    const PixelInfo *pinfo_in = get_pixel_info (type_in);
+    int result = 0;
+    int alpha;
+
+    for (alpha = 1; alpha < 256 && !result; alpha++)
+    {
+        SmolScaleCtx *scale_ctx;
+        SmolScaleInfo info;
+        uint32_t i;
+
+        for (i = 0; i < width_in * height_in; i++)
+        {
+            uint8_t a = ((i + i / width_in) & 1) ? alpha : 255 - alpha / 2;
+
+            memset (&input [i * 4], type_in == SMOL_PIXEL_RGBA8_PREMULTIPLIED ? a : 0xff, 3);
+            input [i * 4 + 3] = a;
+        }
+
+        scale_ctx = smol_scale_new (input, type_in,
+                                    width_in, height_in, width_in * 4,
+                                    output, SMOL_PIXEL_RGBA8_UNASSOCIATED,
+                                    width_out, height_out, width_out * 4,
+                                    1);
+        smol_scale_get_info (scale_ctx, &info);
+        smol_scale_batch (scale_ctx, 0, height_out);
+        smol_scale_destroy (scale_ctx);
+
+        if (info.vertical_first)
+        {
+            fprintf (stdout, "%s %ux%u -> %ux%u: not horizontal-first\n",
+                     pinfo_in->channels, width_in, height_in, width_out, height_out);
+            result = 1;
+        }
+
+        for (i = 0; i < width_out * height_out * 4 && !result; i++)
+        {
+            if (i % 4 == 3 || !output [i | 3] || output [i] >= 0xff - 3)
+                continue;
+
+            fprintf (stdout, "%s %ux%u -> %ux%u, alpha %d: chan %u is %02x (want 0xff)\n",
+                     pinfo_in->channels, width_in, height_in, width_out, height_out,
+                     alpha, i % 4, output [i]);
+            result = 1;
+        }
+    }
+
+    free (input);
+    free (output);
+    return result;
+}
+
+static int
+verify_linear_saturation (void)
+{
+    int result = 0;
+
+    fprintf (stdout, "Linear saturation: ");
+    fflush (stdout);
+
+    smol_set_pass_order (SMOL_PASS_ORDER_HORIZONTAL_FIRST);
+
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_UNASSOCIATED, 20, 8, 11, 8);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_UNASSOCIATED, 8, 20, 8, 11);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_UNASSOCIATED, 40, 4, 13, 4);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_UNASSOCIATED, 7, 5, 19, 13);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_PREMULTIPLIED, 20, 8, 11, 8);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_PREMULTIPLIED, 8, 20, 8, 11);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_PREMULTIPLIED, 40, 4, 13, 4);
+    result |= verify_linear_saturation_dims (SMOL_PIXEL_RGBA8_PREMULTIPLIED, 7, 5, 19, 13);
+
+    smol_set_pass_order (SMOL_PASS_ORDER_AUTO);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+/* Flat unassociated colors, box-scaled horizontal-first in linear space.
+ * The linear premultiplied parts need more than 16 bits. */
+static int
+verify_linear_box_dims (uint32_t width_in, uint32_t height_in,
+                        uint32_t width_out, uint32_t height_out)
+{
+    unsigned char *input = malloc (width_in * height_in * 4);
+    unsigned char *output = malloc (width_out * height_out * 4);
+    int result = 0;
+    int alpha, c;
+
+    for (alpha = 1; alpha < 256 && !result; alpha++)
+    {
+        for (c = 0; c < 256 && !result; c += 17)
+        {
+            unsigned char expected [4] = { c, c, c, alpha };
+            SmolScaleCtx *scale_ctx;
+            SmolScaleInfo info;
+            uint32_t i;
+
+            for (i = 0; i < width_in * height_in; i++)
+                memcpy (&input [i * 4], expected, 4);
+
+            scale_ctx = smol_scale_new (input, SMOL_PIXEL_RGBA8_UNASSOCIATED,
+                                        width_in, height_in, width_in * 4,
+                                        output, SMOL_PIXEL_RGBA8_UNASSOCIATED,
+                                        width_out, height_out, width_out * 4,
+                                        1);
+            smol_scale_get_info (scale_ctx, &info);
+            smol_scale_batch (scale_ctx, 0, height_out);
+            smol_scale_destroy (scale_ctx);
+
+            if (info.vertical_first)
+            {
+                fprintf (stdout, "%ux%u -> %ux%u: not horizontal-first\n",
+                         width_in, height_in, width_out, height_out);
+                result = 1;
+            }
+
+            for (i = 0; i < width_out * height_out && !result; i++)
+            {
+                if (!fuzzy_compare_bytes (&output [i * 4], expected, 4, 1))
+                    continue;
+
+                fprintf (stdout, "%ux%u -> %ux%u: mismatch at %u\n",
+                         width_in, height_in, width_out, height_out, i);
+                fprintf (stdout, "want: "); print_bytes (expected, 4, 4);
+                fprintf (stdout, "out:  "); print_bytes (&output [i * 4], 4, 4);
+                result = 1;
+            }
+        }
+    }
+
+    free (input);
+    free (output);
+    return result;
+}
+
+static int
+verify_linear_box (void)
+{
+    int result = 0;
+    int i;
+
+    fprintf (stdout, "Linear box: ");
+    fflush (stdout);
+
+    smol_set_pass_order (SMOL_PASS_ORDER_HORIZONTAL_FIRST);
+
+    /* The AVX2 implementation has its own box scalers */
+    for (i = 0; i < 2; i++)
+    {
+        smol_set_implementation (i == 0 ? "generic" : NULL);
+
+        result |= verify_linear_box_dims (64, 8, 7, 8);
+        result |= verify_linear_box_dims (8, 64, 8, 7);
+        result |= verify_linear_box_dims (200, 200, 13, 13);
+    }
+
+    smol_set_pass_order (SMOL_PASS_ORDER_AUTO);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
 static int
 verify_preunmul_dir (const unsigned char *input, int n_in,
                      unsigned char *output, int n_out,
@@ -513,6 +688,941 @@ verify_preunmul (void)
     return result;
 }
 
+#define N_MANY_JOBS 8
+
+static int
+verify_many (void)
+{
+    static const uint32_t dims [N_MANY_JOBS] [4] =
+    {
+        { 256, 256, 64, 64 },
+        { 97, 13, 31, 5 },
+        { 256, 256, 64, 64 },
+        { 3, 700, 9, 11 },
+        { 97, 13, 31, 5 },
+        { 256, 256, 64, 64 },
+        /* Wide enough for strips, which are picked per job */
+        { 40000, 3, 36000, 2 },
+        { 40000, 3, 36000, 2 }
+    };
+    SmolScaleJob jobs [N_MANY_JOBS];
+    unsigned char *input [N_MANY_JOBS];
+    unsigned char *output [N_MANY_JOBS];
+    unsigned char *expected_output [N_MANY_JOBS];
+    int result = 0;
+    int i;
+
+    fprintf (stdout, "Many: ");
+    fflush (stdout);
+
+    for (i = 0; i < N_MANY_JOBS; i++)
+    {
+        uint32_t n_in = dims [i] [0] * dims [i] [1] * 4;
+        uint32_t n_out = dims [i] [2] * dims [i] [3] * 4;
+
+        input [i] = malloc (n_in);
+        output [i] = malloc (n_out);
+        expected_output [i] = malloc (n_out);
+
+        jobs [i].pixels_in = input [i];
+        jobs [i].pixel_type_in = SMOL_PIXEL_RGBA8_PREMULTIPLIED;
+        jobs [i].width_in = dims [i] [0];
+        jobs [i].height_in = dims [i] [1];
+        jobs [i].rowstride_in = dims [i] [0] * 4;
+        jobs [i].pixels_out = output [i];
+        jobs [i].pixel_type_out = SMOL_PIXEL_BGRA8_PREMULTIPLIED;
+        jobs [i].width_out = dims [i] [2];
+        jobs [i].height_out = dims [i] [3];
+        jobs [i].rowstride_out = dims [i] [2] * 4;
+        jobs [i].with_srgb = i & 1;
+
+        populate_pixels (input [i], jobs [i].pixel_type_in, n_in);
+        memset (output [i], 0, n_out);
+
+        smol_scale_simple (jobs [i].pixels_in, jobs [i].pixel_type_in,
+                           jobs [i].width_in, jobs [i].height_in, jobs [i].rowstride_in,
+                           expected_output [i], jobs [i].pixel_type_out,
+                           jobs [i].width_out, jobs [i].height_out, jobs [i].rowstride_out,
+                           jobs [i].with_srgb);
+    }
+
+    smol_scale_many (jobs, N_MANY_JOBS);
+
+    for (i = 0; i < N_MANY_JOBS; i++)
+    {
+        if (memcmp (output [i], expected_output [i], dims [i] [2] * dims [i] [3] * 4))
+        {
+            fprintf (stdout, "job %d (%ux%u -> %ux%u): mismatch\n",
+                     i, dims [i] [0], dims [i] [1], dims [i] [2], dims [i] [3]);
+            result = 1;
+        }
+
+        free (input [i]);
+        free (output [i]);
+        free (expected_output [i]);
+    }
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+static int
+verify_storage (void)
+{
+    /* Input rows start 1 byte in, so the unaligned row path is exercised */
+    unsigned char input [1 + 301 * 4 * 77];
+    unsigned char output [97 * 4 * 23];
+    unsigned char expected_output [97 * 4 * 23];
+    void *storage, *scratch;
+    SmolScaleCtx *scale_ctx;
+    size_t size;
+    int result = 0;
+
+    fprintf (stdout, "Storage: ");
+    fflush (stdout);
+
+    populate_pixels (input, SMOL_PIXEL_RGBA8_PREMULTIPLIED, sizeof (input));
+
+    smol_scale_simple (input + 1, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 301, 77, 301 * 4,
+                       expected_output, SMOL_PIXEL_ARGB8_UNASSOCIATED, 97, 23, 97 * 4,
+                       1);
+
+    size = smol_scale_ctx_size (301, 77, 97, 23);
+    storage = malloc (size);
+
+    if (smol_scale_init_in_storage (storage, size - 1,
+                                    input + 1, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 301, 77, 301 * 4,
+                                    output, SMOL_PIXEL_ARGB8_UNASSOCIATED, 97, 23, 97 * 4,
+                                    1, NULL, NULL))
+    {
+        fprintf (stdout, "accepted short storage\n");
+        result = 1;
+    }
+
+    scale_ctx = smol_scale_init_in_storage (storage, size,
+                                            input + 1, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 301, 77, 301 * 4,
+                                            output, SMOL_PIXEL_ARGB8_UNASSOCIATED, 97, 23, 97 * 4,
+                                            1, NULL, NULL);
+    scratch = malloc (smol_scale_get_scratch_size (scale_ctx));
+
+    smol_scale_batch_with_scratch (scale_ctx, scratch, NULL, 0, 10);
+    smol_scale_batch_with_scratch (scale_ctx, scratch, output + 10 * 97 * 4, 10, 13);
+
+    if (memcmp (output, expected_output, sizeof (output)))
+    {
+        fprintf (stdout, "mismatch\n");
+        result = 1;
+    }
+
+    free (scratch);
+    free (storage);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+typedef struct
+{
+    unsigned char *output;
+    uint32_t next_row;
+    int bad_order;
+}
+SinkData;
+
+static void
+sink_row (const void *row_out, uint32_t outrow_index, uint32_t width, void *user_data)
+{
+    SinkData *sink_data = user_data;
+
+    if (outrow_index != sink_data->next_row)
+        sink_data->bad_order = 1;
+    sink_data->next_row = outrow_index + 1;
+
+    memcpy (sink_data->output + outrow_index * width * 4, row_out, width * 4);
+}
+
+static int
+verify_sink (void)
+{
+    unsigned char input [173 * 4 * 211];
+    unsigned char output [61 * 4 * 449];
+    unsigned char expected_output [61 * 4 * 449];
+    SmolScaleCtx *scale_ctx;
+    SinkData sink_data;
+    int result = 0;
+
+    fprintf (stdout, "Sink: ");
+    fflush (stdout);
+
+    populate_pixels (input, SMOL_PIXEL_BGRA8_UNASSOCIATED, sizeof (input));
+
+    smol_scale_simple (input, SMOL_PIXEL_BGRA8_UNASSOCIATED, 173, 211, 173 * 4,
+                       expected_output, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 61, 449, 61 * 4,
+                       0);
+
+    scale_ctx = smol_scale_new_full (input, SMOL_PIXEL_BGRA8_UNASSOCIATED, 173, 211, 173 * 4,
+                                     NULL, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 61, 449, 61 * 4,
+                                     0, NULL, NULL);
+
+    memset (output, 0, sizeof (output));
+    sink_data.output = output;
+    sink_data.next_row = 0;
+    sink_data.bad_order = 0;
+
+    smol_scale_batch_to_sink (scale_ctx, NULL, 0, 200, sink_row, &sink_data);
+    smol_scale_batch_to_sink (scale_ctx, NULL, 200, 249, sink_row, &sink_data);
+    smol_scale_destroy (scale_ctx);
+
+    if (sink_data.bad_order || sink_data.next_row != 449)
+    {
+        fprintf (stdout, "bad row order\n");
+        result = 1;
+    }
+    else if (memcmp (output, expected_output, sizeof (output)))
+    {
+        fprintf (stdout, "mismatch\n");
+        result = 1;
+    }
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+/* Wide images are scaled in column strips, except when going to a sink.
+ * The two must match exactly. */
+static int
+verify_strips_dims (uint32_t width_in, uint32_t height_in,
+                    uint32_t width_out, uint32_t height_out,
+                    uint8_t with_srgb)
+{
+    unsigned char *input, *output, *expected_output;
+    size_t n_out = (size_t) width_out * height_out * 4;
+    SmolScaleCtx *scale_ctx;
+    SmolScaleInfo info;
+    SinkData sink_data;
+    int result = 0;
+
+    input = malloc ((size_t) width_in * height_in * 4);
+    output = calloc (1, n_out);
+    expected_output = calloc (1, n_out);
+
+    populate_pixels (input, SMOL_PIXEL_RGBA8_UNASSOCIATED, width_in * height_in * 4);
+
+    scale_ctx = smol_scale_new_full (input, SMOL_PIXEL_RGBA8_UNASSOCIATED,
+                                     width_in, height_in, width_in * 4,
+                                     NULL, SMOL_PIXEL_BGRA8_PREMULTIPLIED,
+                                     width_out, height_out, width_out * 4,
+                                     with_srgb, NULL, NULL);
+    smol_scale_get_info (scale_ctx, &info);
+
+    sink_data.output = expected_output;
+    sink_data.next_row = 0;
+    sink_data.bad_order = 0;
+
+    smol_scale_batch_to_sink (scale_ctx, NULL, 0, height_out, sink_row, &sink_data);
+    smol_scale_destroy (scale_ctx);
+
+    smol_scale_simple (input, SMOL_PIXEL_RGBA8_UNASSOCIATED, width_in, height_in, width_in * 4,
+                       output, SMOL_PIXEL_BGRA8_PREMULTIPLIED, width_out, height_out, width_out * 4,
+                       with_srgb);
+
+    if (!info.strip_width)
+    {
+        fprintf (stdout, "no strips for %ux%u -> %ux%u\n",
+                 width_in, height_in, width_out, height_out);
+        result = 1;
+    }
+    else if (memcmp (output, expected_output, n_out))
+    {
+        fprintf (stdout, "mismatch for %ux%u -> %ux%u\n",
+                 width_in, height_in, width_out, height_out);
+        result = 1;
+    }
+
+    free (expected_output);
+    free (output);
+    free (input);
+
+    return result;
+}
+
+static int
+verify_strips (void)
+{
+    int result = 0;
+
+    fprintf (stdout, "Strips: ");
+    fflush (stdout);
+
+    result |= verify_strips_dims (40000, 7, 33001, 19, 0);
+    result |= verify_strips_dims (20011, 9, 51000, 23, 1);
+    result |= verify_strips_dims (40000, 5, 40000, 13, 0);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+/* Big outputs are written with non-temporal stores, except when going to
+ * a sink. Padded rows make the stores start unaligned. */
+static int
+verify_stream_output_rows (const unsigned char *output, uint32_t rowstride,
+                           const unsigned char *expected_output,
+                           uint32_t width, uint32_t height,
+                           SmolPixelType type_in, SmolPixelType type_out,
+                           const char *what)
+{
+    uint32_t i;
+
+    for (i = 0; i < height; i++)
+    {
+        if (memcmp (output + i * rowstride, expected_output + i * width * 4, width * 4))
+        {
+            fprintf (stdout, "%s mismatch for %s -> %s in row %u\n", what,
+                     get_pixel_info (type_in)->channels, get_pixel_info (type_out)->channels, i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* The output is big enough to be streamed, but sinks and other buffers
+ * must get the same rows written normally */
+static int
+verify_stream_output_dims (SmolPixelType type_in, SmolPixelType type_out)
+{
+    const uint32_t width_in = 1031, height_in = 1029;
+    const uint32_t width_out = 4099, height_out = 4097;
+    const uint32_t rowstride_out = width_out * 4 + 4;
+    unsigned char *input, *output, *full_output, *expected_output;
+    SmolScaleCtx *scale_ctx;
+    SmolScaleInfo info;
+    SinkData sink_data;
+    int result = 0;
+
+    input = malloc (width_in * height_in * 4);
+    output = calloc (1, (size_t) rowstride_out * height_out);
+    full_output = calloc (1, (size_t) rowstride_out * height_out);
+    expected_output = calloc (1, (size_t) width_out * height_out * 4);
+
+    populate_pixels (input, type_in, width_in * height_in * 4);
+
+    scale_ctx = smol_scale_new_full (input, type_in, width_in, height_in, width_in * 4,
+                                     NULL, type_out, width_out, height_out, width_out * 4,
+                                     0, NULL, NULL);
+    smol_scale_batch_full (scale_ctx, expected_output, 0, height_out);
+    smol_scale_destroy (scale_ctx);
+
+    scale_ctx = smol_scale_new_full (input, type_in, width_in, height_in, width_in * 4,
+                                     output, type_out, width_out, height_out, rowstride_out,
+                                     0, NULL, NULL);
+    smol_scale_get_info (scale_ctx, &info);
+
+    /* Only the AVX2 packers stream */
+    if (!strcmp (info.implementation_v, "avx2") && !info.stream_output)
+    {
+        fprintf (stdout, "no streaming for %s -> %s\n",
+                 get_pixel_info (type_in)->channels, get_pixel_info (type_out)->channels);
+        result = 1;
+    }
+
+    sink_data.output = output;
+    sink_data.next_row = 0;
+    sink_data.bad_order = 0;
+    smol_scale_batch_to_sink (scale_ctx, NULL, 0, height_out, sink_row, &sink_data);
+    result |= verify_stream_output_rows (output, width_out * 4, expected_output,
+                                         width_out, height_out, type_in, type_out, "sink");
+
+    smol_scale_batch_full (scale_ctx, full_output, 0, height_out);
+    result |= verify_stream_output_rows (full_output, rowstride_out, expected_output,
+                                         width_out, height_out, type_in, type_out, "batch_full");
+
+    memset (output, 0, (size_t) rowstride_out * height_out);
+    smol_scale_batch (scale_ctx, 0, height_out);
+    result |= verify_stream_output_rows (output, rowstride_out, expected_output,
+                                         width_out, height_out, type_in, type_out, "batch");
+
+    smol_scale_destroy (scale_ctx);
+
+    free (expected_output);
+    free (full_output);
+    free (output);
+    free (input);
+
+    return result;
+}
+
+static int
+verify_stream_output (void)
+{
+    int result = 0;
+
+    fprintf (stdout, "Stream output: ");
+    fflush (stdout);
+
+    result |= verify_stream_output_dims (SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_BGRA8_PREMULTIPLIED);
+    result |= verify_stream_output_dims (SMOL_PIXEL_ARGB8_UNASSOCIATED, SMOL_PIXEL_RGBA8_UNASSOCIATED);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+static int
+verify_in_place_dims (SmolPixelType type_in, uint32_t width_in, uint32_t height_in,
+                      SmolPixelType type_out, uint32_t width_out, uint32_t height_out)
+{
+    uint32_t rowstride_in = width_in * get_pixel_info (type_in)->n_channels;
+    uint32_t rowstride_out = width_out * get_pixel_info (type_out)->n_channels;
+    uint32_t size_in = rowstride_in * height_in;
+    uint32_t size_out = rowstride_out * height_out;
+    unsigned char *buf, *expected_output;
+    int result = 0;
+
+    buf = malloc (size_in > size_out ? size_in : size_out);
+    expected_output = malloc (size_out);
+
+    populate_pixels (buf, type_in, size_in);
+
+    smol_scale_simple (buf, type_in, width_in, height_in, rowstride_in,
+                       expected_output, type_out, width_out, height_out, rowstride_out,
+                       0);
+    smol_scale_simple (buf, type_in, width_in, height_in, rowstride_in,
+                       buf, type_out, width_out, height_out, rowstride_out,
+                       0);
+
+    if (memcmp (buf, expected_output, size_out))
+    {
+        fprintf (stdout, "mismatch for %ux%u -> %ux%u\n",
+                 width_in, height_in, width_out, height_out);
+        result = 1;
+    }
+
+    free (expected_output);
+    free (buf);
+    return result;
+}
+
+static int
+verify_in_place (void)
+{
+    uint32_t height_in, height_out;
+    int result = 0;
+
+    fprintf (stdout, "In-place: ");
+    fflush (stdout);
+
+    /* Downscales of every kind, including halvings */
+    for (height_in = 1; height_in < 70 && !result; height_in++)
+    {
+        for (height_out = 1; height_out <= height_in && !result; height_out++)
+        {
+            result |= verify_in_place_dims (SMOL_PIXEL_RGBA8_UNASSOCIATED, 37, height_in,
+                                            SMOL_PIXEL_RGBA8_PREMULTIPLIED, 23, height_out);
+            result |= verify_in_place_dims (SMOL_PIXEL_BGRA8_PREMULTIPLIED, 37, height_in,
+                                            SMOL_PIXEL_RGB8, 37, height_out);
+        }
+    }
+
+    /* Same height with wider output rows; processed bottom-up */
+    if (!result)
+        result |= verify_in_place_dims (SMOL_PIXEL_RGB8, 51, 43,
+                                        SMOL_PIXEL_ARGB8_PREMULTIPLIED, 51, 43);
+    if (!result)
+        result |= verify_in_place_dims (SMOL_PIXEL_RGBA8_PREMULTIPLIED, 51, 43,
+                                        SMOL_PIXEL_ABGR8_PREMULTIPLIED, 77, 43);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+static int
+verify_stats (void)
+{
+    unsigned char input [83 * 4 * 59];
+    unsigned char output [31 * 4 * 41];
+    SmolScaleCtx *scale_ctx;
+    SmolScaleStats stats;
+    int result = 0;
+
+    fprintf (stdout, "Stats: ");
+    fflush (stdout);
+
+    populate_pixels (input, SMOL_PIXEL_RGBA8_PREMULTIPLIED, sizeof (input));
+
+    scale_ctx = smol_scale_new (input, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 83, 59, 83 * 4,
+                                output, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 31, 41, 31 * 4,
+                                0);
+    smol_scale_batch (scale_ctx, 0, 20);
+    smol_scale_batch (scale_ctx, 20, 21);
+
+    if (!smol_scale_get_stats (scale_ctx, &stats))
+    {
+        fprintf (stdout, "not built in\n");
+        smol_scale_destroy (scale_ctx);
+        return 0;
+    }
+
+    if (stats.n_calls [SMOL_STAGE_VFILTER] != 41
+        || stats.n_calls [SMOL_STAGE_PACK] != 41
+        || stats.n_calls [SMOL_STAGE_UNPACK] != stats.n_calls [SMOL_STAGE_HFILTER]
+        || stats.n_calls [SMOL_STAGE_UNPACK] < 59
+        || stats.n_calls [SMOL_STAGE_POST_ROW] != 0)
+    {
+        fprintf (stdout, "unexpected call counts\n");
+        result = 1;
+    }
+
+    smol_scale_reset_stats (scale_ctx);
+    smol_scale_get_stats (scale_ctx, &stats);
+
+    if (stats.n_calls [SMOL_STAGE_VFILTER] != 0 || stats.ticks [SMOL_STAGE_VFILTER] != 0)
+    {
+        fprintf (stdout, "reset failed\n");
+        result = 1;
+    }
+
+    smol_scale_destroy (scale_ctx);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+static int
+verify_info_dims (uint32_t width_in, uint32_t height_in,
+                  uint32_t width_out, uint32_t height_out,
+                  SmolPixelType type_in, SmolPixelType type_out,
+                  uint8_t with_srgb,
+                  const char *filter_h, const char *filter_v,
+                  uint32_t storage_bpp, uint8_t expect_srgb,
+                  uint8_t expect_vertical_first)
+{
+    SmolScaleCtx *scale_ctx;
+    SmolScaleInfo info;
+    int result = 0;
+
+    scale_ctx = smol_scale_new (NULL, type_in, width_in, height_in, width_in * 4,
+                                NULL, type_out, width_out, height_out, width_out * 4,
+                                with_srgb);
+    smol_scale_get_info (scale_ctx, &info);
+    smol_scale_destroy (scale_ctx);
+
+    if (strcmp (info.filter_h, filter_h) || strcmp (info.filter_v, filter_v)
+        || info.storage_bpp != storage_bpp || info.with_srgb != expect_srgb
+        || info.vertical_first != expect_vertical_first
+        || !info.implementation_h || !info.implementation_v)
+    {
+        fprintf (stdout, "unexpected plan for %ux%u -> %ux%u: %s/%s %ubpp srgb=%u vfirst=%u\n",
+                 width_in, height_in, width_out, height_out,
+                 info.filter_h, info.filter_v, info.storage_bpp, info.with_srgb,
+                 info.vertical_first);
+        result = 1;
+    }
+
+    return result;
+}
+
+static int
+verify_info (void)
+{
+    int result = 0;
+
+    fprintf (stdout, "Info: ");
+    fflush (stdout);
+
+    result |= verify_info_dims (100, 100, 100, 100,
+                                SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 0,
+                                "copy", "copy", 64, 0, 0);
+    result |= verify_info_dims (1, 100, 50, 100,
+                                SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 1,
+                                "one", "copy", 128, 1, 0);
+    result |= verify_info_dims (100, 100, 30, 20,
+                                SMOL_PIXEL_RGBA8_UNASSOCIATED, SMOL_PIXEL_BGRA8_UNASSOCIATED, 0,
+                                "bilinear-1h", "bilinear-2h", 128, 0, 0);
+    result |= verify_info_dims (1000, 9000, 10, 1,
+                                SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 0,
+                                "box", "box", 128, 0, 0);
+    result |= verify_info_dims (9000, 10, 1, 10,
+                                SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 1,
+                                "box", "copy", 128, 0, 0);
+    result |= verify_info_dims (40, 4000, 400, 40,
+                                SMOL_PIXEL_RGBA8_PREMULTIPLIED, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 0,
+                                "bilinear-0h", "box", 64, 0, 1);
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+#define PASS_ORDER_FUZZ 2
+
+/* Random pixels, with colors clamped to alpha where it's premultiplied */
+static void
+populate_random_pixels (unsigned char *buf, SmolPixelType type, int n_pixels, uint32_t seed)
+{
+    const PixelInfo *pinfo = get_pixel_info (type);
+    const char *alpha_ch = strchr (pinfo->channels, 'a');
+    int i, ch;
+
+    for (i = 0; i < n_pixels * pinfo->n_channels; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        buf [i] = seed >> 16;
+    }
+
+    if (!alpha_ch)
+        return;
+
+    for (i = 0; i < n_pixels; i++)
+    {
+        unsigned char *p = buf + i * pinfo->n_channels;
+        unsigned char alpha = p [alpha_ch - pinfo->channels];
+
+        for (ch = 0; ch < pinfo->n_channels; ch++)
+            if (p [ch] > alpha)
+                p [ch] = alpha;
+    }
+}
+
+/* Returns the largest channel difference, with unassociated colors
+ * premultiplied first */
+static int
+get_max_premul_diff (const unsigned char *a, const unsigned char *b,
+                     SmolPixelType type, int n_pixels)
+{
+    const PixelInfo *pinfo = get_pixel_info (type);
+    const char *alpha_ch = strchr (pinfo->channels, 'A');
+    int max_diff = 0;
+    int i, ch;
+
+    for (i = 0; i < n_pixels * pinfo->n_channels; i += pinfo->n_channels)
+    {
+        for (ch = 0; ch < pinfo->n_channels; ch++)
+        {
+            int va = a [i + ch], vb = b [i + ch];
+
+            if (alpha_ch && pinfo->channels [ch] != 'A')
+            {
+                int ach = alpha_ch - pinfo->channels;
+
+                va = (va * a [i + ach] + 127) / 255;
+                vb = (vb * b [i + ach] + 127) / 255;
+            }
+
+            if (abs (va - vb) > max_diff)
+                max_diff = abs (va - vb);
+        }
+    }
+
+    return max_diff;
+}
+
+static int
+verify_pass_order_dims (uint32_t width_in, uint32_t height_in,
+                        uint32_t width_out, uint32_t height_out,
+                        SmolPixelType type_in, SmolPixelType type_out,
+                        uint8_t with_srgb)
+{
+    const PixelInfo *pinfo_in = get_pixel_info (type_in);
+    const PixelInfo *pinfo_out = get_pixel_info (type_out);
+    uint32_t rowstride_in = width_in * pinfo_in->n_channels;
+    uint32_t rowstride_out = width_out * pinfo_out->n_channels;
+    unsigned char *input, *output_h, *output_v;
+    SmolScaleCtx *scale_ctx;
+    SmolScaleInfo info;
+    int max_diff;
+    int result = 0;
+
+    input = malloc (rowstride_in * height_in);
+    output_h = malloc (rowstride_out * height_out);
+    output_v = malloc (rowstride_out * height_out);
+
+    populate_random_pixels (input, type_in, width_in * height_in,
+                            width_in * 7 + height_in * 13 + type_in);
+
+    smol_set_pass_order (SMOL_PASS_ORDER_HORIZONTAL_FIRST);
+    smol_scale_simple (input, type_in, width_in, height_in, rowstride_in,
+                       output_h, type_out, width_out, height_out, rowstride_out,
+                       with_srgb);
+
+    smol_set_pass_order (SMOL_PASS_ORDER_VERTICAL_FIRST);
+    scale_ctx = smol_scale_new (input, type_in, width_in, height_in, rowstride_in,
+                                output_v, type_out, width_out, height_out, rowstride_out,
+                                with_srgb);
+    smol_scale_get_info (scale_ctx, &info);
+    smol_scale_batch (scale_ctx, 0, height_out);
+    smol_scale_destroy (scale_ctx);
+
+    smol_set_pass_order (SMOL_PASS_ORDER_AUTO);
+
+    max_diff = get_max_premul_diff (output_h, output_v, type_out, width_out * height_out);
+
+    /* Premultiplying the 8-bit unassociated output adds a rounding step */
+    if (!info.vertical_first
+        || max_diff > PASS_ORDER_FUZZ + (strchr (pinfo_out->channels, 'A') ? 1 : 0))
+    {
+        fprintf (stdout, "%ux%u %s -> %ux%u %s srgb=%u: vfirst=%u, diff %d\n",
+                 width_in, height_in, pinfo_in->channels,
+                 width_out, height_out, pinfo_out->channels,
+                 with_srgb, info.vertical_first, max_diff);
+        result = 1;
+    }
+
+    free (output_v);
+    free (output_h);
+    free (input);
+
+    return result;
+}
+
+static int
+verify_pass_order (void)
+{
+    static const uint32_t dims [] [4] =
+    {
+        {  97, 301,  61,  29 },
+        {  40, 400, 400,  40 },
+        { 211,  37,  19, 101 },
+        { 300, 200, 130,  77 }
+    };
+    int result = 0;
+    int i, j, k, srgb;
+
+    fprintf (stdout, "Pass order: ");
+    fflush (stdout);
+
+    for (i = 0; pixel_info [i].type != SMOL_PIXEL_MAX; i++)
+    {
+        for (j = 0; pixel_info [j].type != SMOL_PIXEL_MAX; j++)
+        {
+            for (srgb = 0; srgb < 2; srgb++)
+            {
+                /* Dropping alpha leaves colors that were divided by it with
+                 * nothing to premultiply them by again */
+                if (srgb && pixel_info [i].n_channels == 4 && pixel_info [j].n_channels == 3)
+                    continue;
+
+                for (k = 0; k < (int) (sizeof (dims) / sizeof (dims [0])); k++)
+                {
+                    result |= verify_pass_order_dims (dims [k] [0], dims [k] [1],
+                                                      dims [k] [2], dims [k] [3],
+                                                      pixel_info [i].type, pixel_info [j].type,
+                                                      srgb);
+                }
+            }
+        }
+    }
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+static const char *
+get_implementation_h (void)
+{
+    SmolScaleCtx *scale_ctx;
+    SmolScaleInfo info;
+
+    scale_ctx = smol_scale_new (NULL, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 100, 100, 400,
+                                NULL, SMOL_PIXEL_RGBA8_PREMULTIPLIED, 50, 50, 200,
+                                0);
+    smol_scale_get_info (scale_ctx, &info);
+    smol_scale_destroy (scale_ctx);
+
+    return info.implementation_h;
+}
+
+static int
+verify_implementation (void)
+{
+    const char *impl_auto;
+    int result = 0;
+
+    fprintf (stdout, "Implementation: ");
+    fflush (stdout);
+
+    impl_auto = get_implementation_h ();
+
+    if (smol_set_implementation ("bogus"))
+    {
+        fprintf (stdout, "accepted unknown implementation\n");
+        result = 1;
+    }
+
+    if (!smol_set_implementation ("generic")
+        || strcmp (get_implementation_h (), "generic"))
+    {
+        fprintf (stdout, "could not force generic implementation\n");
+        result = 1;
+    }
+
+    if (!smol_set_implementation (NULL)
+        || strcmp (get_implementation_h (), impl_auto))
+    {
+        fprintf (stdout, "could not restore automatic selection\n");
+        result = 1;
+    }
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
+typedef struct
+{
+    int n_allocs;
+    int n_frees;
+    int bad_alignment;
+}
+AllocCounts;
+
+static void *
+counting_alloc (size_t size, void *user_data)
+{
+    AllocCounts *counts = user_data;
+
+    counts->n_allocs++;
+    return malloc (size);
+}
+
+static void *
+counting_aligned_alloc (size_t size, size_t alignment, void *user_data)
+{
+    AllocCounts *counts = user_data;
+    void *p;
+
+    if (alignment & (alignment - 1) || posix_memalign (&p, alignment, size))
+    {
+        counts->bad_alignment = 1;
+        return NULL;
+    }
+
+    counts->n_allocs++;
+    return p;
+}
+
+static void
+counting_free (void *p, void *user_data)
+{
+    AllocCounts *counts = user_data;
+
+    counts->n_frees++;
+    free (p);
+}
+
+static int
+verify_allocator_counts (const char *what, const AllocCounts *counts)
+{
+    if (counts->bad_alignment)
+    {
+        fprintf (stdout, "%s: bad alignment\n", what);
+        return 1;
+    }
+
+    if (counts->n_allocs == 0 || counts->n_allocs != counts->n_frees)
+    {
+        fprintf (stdout, "%s: %d allocations, %d frees\n",
+                 what, counts->n_allocs, counts->n_frees);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+verify_allocator (void)
+{
+    unsigned char input [173 * 4 * 211 + 1];
+    unsigned char output [61 * 4 * 449];
+    unsigned char expected_output [61 * 4 * 449];
+    AllocCounts global_counts = { 0, 0, 0 };
+    AllocCounts ctx_counts = { 0, 0, 0 };
+    SmolAllocator global_allocator = { counting_alloc, counting_free, NULL, &global_counts };
+    SmolAllocator ctx_allocator = { counting_alloc, counting_free, counting_aligned_alloc, &ctx_counts };
+    SmolScaleCtx *scale_ctx;
+    int result = 0;
+
+    fprintf (stdout, "Allocator: ");
+    fflush (stdout);
+
+    /* Unaligned input, so the alignment buffer is used too */
+    populate_pixels (input + 1, SMOL_PIXEL_RGBA8_UNASSOCIATED, sizeof (input) - 1);
+
+    smol_scale_simple (input + 1, SMOL_PIXEL_RGBA8_UNASSOCIATED, 173, 211, 173 * 4,
+                       expected_output, SMOL_PIXEL_BGRA8_PREMULTIPLIED, 61, 449, 61 * 4,
+                       1);
+
+    /* Global allocator. It's restored before the batches, which must keep
+     * using the one the context was created with. */
+
+    smol_set_allocator (&global_allocator);
+    scale_ctx = smol_scale_new (input + 1, SMOL_PIXEL_RGBA8_UNASSOCIATED, 173, 211, 173 * 4,
+                                output, SMOL_PIXEL_BGRA8_PREMULTIPLIED, 61, 449, 61 * 4,
+                                1);
+    smol_set_allocator (NULL);
+
+    memset (output, 0, sizeof (output));
+    smol_scale_batch (scale_ctx, 0, 200);
+    smol_scale_batch (scale_ctx, 200, 249);
+    smol_scale_destroy (scale_ctx);
+
+    result |= verify_allocator_counts ("global", &global_counts);
+    if (!result && memcmp (output, expected_output, sizeof (output)))
+    {
+        fprintf (stdout, "global: mismatch\n");
+        result = 1;
+    }
+
+    /* Per-context allocator with aligned allocations */
+
+    memset (&global_counts, 0, sizeof (global_counts));
+    smol_set_allocator (&global_allocator);
+    scale_ctx = smol_scale_new_with_allocator (input + 1, SMOL_PIXEL_RGBA8_UNASSOCIATED,
+                                               173, 211, 173 * 4,
+                                               output, SMOL_PIXEL_BGRA8_PREMULTIPLIED,
+                                               61, 449, 61 * 4,
+                                               1, NULL, NULL, &ctx_allocator);
+
+    memset (output, 0, sizeof (output));
+    smol_scale_batch (scale_ctx, 0, 449);
+    smol_scale_destroy (scale_ctx);
+    smol_set_allocator (NULL);
+
+    result |= verify_allocator_counts ("context", &ctx_counts);
+    if (!result && global_counts.n_allocs)
+    {
+        fprintf (stdout, "context: used the global allocator\n");
+        result = 1;
+    }
+    else if (!result && memcmp (output, expected_output, sizeof (output)))
+    {
+        fprintf (stdout, "context: mismatch\n");
+        result = 1;
+    }
+
+    if (!result)
+        fprintf (stdout, "ok\n");
+
+    return result;
+}
+
 int
 main (int argc, char *argv [])
 {
@@ -521,7 +1631,20 @@ main (int argc, char *argv [])
     result += verify_ordering ();
     result += verify_unassociated_alpha ();
     result += verify_saturation ();
+    result += verify_linear_saturation ();
+    result += verify_linear_box ();
     result += verify_preunmul ();
+    result += verify_many ();
+    result += verify_storage ();
+    result += verify_sink ();
+    result += verify_strips ();
+    result += verify_stream_output ();
+    result += verify_in_place ();
+    result += verify_stats ();
+    result += verify_info ();
+    result += verify_pass_order ();
+    result += verify_implementation ();
+    result += verify_allocator ();
 
     return result;
 }